@@ -2,6 +2,10 @@
 
 #include "accessrecord.h"
 #include "scheduler.h"
+#include "slab.h"
+#include "output.h"
+
+struct Slab accessrecord_slab = SLAB_INIT(struct AccessRecordNode, N_FRAMES > 0 ? N_FRAMES : 1);
 
 // Linked list of frame records sorted least recently used -> most recently used.
 
@@ -9,38 +13,37 @@ int accessrecord_isempty(struct AccessRecord *access_r) {
     return access_r->oldest == NULL;
 }
 
-// Get least recently used element
-frame_num_t accessrecord_get_lru(struct AccessRecord *access_r) {
-    // Empty queue
-    if (accessrecord_isempty(access_r)) {
-        printf("accessrecord: Runtime error: attempted to get LRU element from empty AccessRecord.\n");
-        exit(99);
-    }
-
-    // Output frame number (save before delete)
-    frame_num_t out = access_r->oldest->frame;
-
-    // Invalidate the frame for its previous owner (if present)
-    struct Scheduler *sch = get_running_scheduler();
-    if (sch != NULL) {
-        // Invalidate pages if the scheduler is running.
-        struct pcb *owner = get_running_pcb_by_pid(sch, access_r->oldest->owner);
-        if (owner != NULL) {
-            page_tbl_invalidate_frame(owner->page_tbl, out);
+// Look at the least recently used frame `eligible` accepts. Return
+// UNKNOWN_FRAME if it accepts none.
+frame_num_t accessrecord_peek_lru_where(struct AccessRecord *access_r, int (*eligible)(frame_num_t frame, void *ctx), void *ctx, spid_t *owner) {
+    for (struct AccessRecordNode *cursor = access_r->oldest; cursor != NULL; cursor = cursor->next_newest) {
+        if (eligible(cursor->frame, ctx)) {
+            *owner = cursor->owner;
+            return cursor->frame;
         }
     }
+    return UNKNOWN_FRAME;
+}
 
-    // Delete entry
-    struct AccessRecordNode *to_delete = access_r->oldest;
-    if (access_r->oldest->next_newest == NULL) {
-        // one element list
-        access_r->newest = NULL;
+// Remove a frame from the record, to be reloaded
+void accessrecord_remove(struct AccessRecord *access_r, frame_num_t frame) {
+    // Mappings of the old contents go stale when the frame is reloaded (its
+    // generation changes), so no page table needs updating here
+    struct AccessRecordNode **link = &access_r->oldest;
+    struct AccessRecordNode *prev = NULL;
+    while (*link != NULL && (*link)->frame != frame) {
+        prev = *link;
+        link = &(*link)->next_newest;
+    }
+    if (*link == NULL) {
+        output_printf("accessrecord: Runtime error: attempted to remove a frame not in the AccessRecord.\n");
+        exit(99);
     }
-    access_r->oldest = access_r->oldest->next_newest;
-    free(to_delete);
 
-    // Return frame number
-    return out;
+    struct AccessRecordNode *to_delete = *link;
+    *link = to_delete->next_newest;
+    if (access_r->newest == to_delete) { access_r->newest = prev; }
+    slab_free(&accessrecord_slab, to_delete);
 }
 
 // Update AccessRecord in light of a frame number being accessed.
@@ -57,9 +60,9 @@ void accessrecord_frame_used(struct AccessRecord *access_r, frame_num_t used, sp
                     // Found existing node for used frame number
                     used_node = cursor->next_newest;
                     
-                    // Stitch together
-                    cursor->next_newest = used_node->next_newest;
-                    
+                    // Stitch together (the newest node stays where it is)
+                    if (used_node->next_newest != NULL) { cursor->next_newest = used_node->next_newest; }
+
                     break;
                 }
                 cursor = cursor->next_newest;
@@ -70,7 +73,7 @@ void accessrecord_frame_used(struct AccessRecord *access_r, frame_num_t used, sp
     if (used_node == NULL) {
         // frame number was not in the list
         // create new node
-        used_node = (struct AccessRecordNode *) malloc(sizeof(struct AccessRecordNode));
+        used_node = slab_alloc(&accessrecord_slab);
         used_node->frame = used;
 
         // handle empty list
@@ -93,11 +96,9 @@ void accessrecord_frame_used(struct AccessRecord *access_r, frame_num_t used, sp
     used_node->owner = owner;
 }
 
-// Empty access record and free contents
+// Empty access record and release its nodes in bulk
 void accessrecord_empty(struct AccessRecord *access_r) {
-    while (access_r->oldest != NULL) {
-        struct AccessRecordNode *to_free = access_r->oldest;
-        access_r->oldest = access_r->oldest->next_newest;
-        free(to_free);
-    }
+    access_r->oldest = NULL;
+    access_r->newest = NULL;
+    slab_release(&accessrecord_slab);
 }
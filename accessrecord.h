@@ -13,6 +13,7 @@ struct AccessRecord {
     struct AccessRecordNode *newest;
 };
 
-frame_num_t accessrecord_get_lru(struct AccessRecord *access_r);
+frame_num_t accessrecord_peek_lru_where(struct AccessRecord *access_r, int (*eligible)(frame_num_t frame, void *ctx), void *ctx, spid_t *owner);
+void accessrecord_remove(struct AccessRecord *access_r, frame_num_t frame);
 void accessrecord_frame_used(struct AccessRecord *access_r, frame_num_t used, spid_t owner);
 void accessrecord_empty(struct AccessRecord *access_r);
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "checkpoint.h"
+#include "codestore.h"
+#include "scheduler.h"
+#include "varstore.h"
+#include "memgroup.h"
+
+// Write a length-prefixed string
+int _checkpoint_write_str(FILE *f, const char *s) {
+    uint16_t len = strlen(s);
+    return fwrite(&len, sizeof(len), 1, f) == 1 && fwrite(s, 1, len, f) == len;
+}
+
+// Read a length-prefixed string into a fresh buffer, NULL on a short read
+char *_checkpoint_read_str(FILE *f) {
+    uint16_t len;
+    if (fread(&len, sizeof(len), 1, f) != 1) { return NULL; }
+    char *s = malloc(len + 1);
+    if (fread(s, 1, len, f) != len) {
+        free(s);
+        return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+// Collect a process's resident pages, most recently referenced first
+int _checkpoint_resident_pages(struct pcb *p, uint16_t *pages) {
+    int n = 0;
+    for (int page = 0; page < PAGE_TBL_SIZE; page++) {
+        if (!page_tbl_lookup(p->page_tbl, page).valid) { continue; }
+        int i = n++;
+        for (; i > 0 && p->ws.last_ref[pages[i - 1]] < p->ws.last_ref[page]; i--) { pages[i] = pages[i - 1]; }
+        pages[i] = page;
+    }
+    return n;
+}
+
+// Write a checkpoint image of a process (atomically replacing `path`)
+enum CheckpointStatus checkpoint_save(struct pcb *p, const char *path) {
+    if (p->src->streamed) { return CHECKPOINT_STREAMED; }
+    struct CheckpointHeader h = {
+        .pid = p->pid,
+        // A process checkpointing itself resumes after the checkpoint line
+        .pc = p->pc + (p->pid == getspid()),
+        .dev = p->src->dev,
+        .ino = p->src->ino,
+        .size = p->src->size,
+        .mtime_sec = p->src->mtime.tv_sec,
+        .mtime_nsec = p->src->mtime.tv_nsec,
+        .n_loops = p->n_loops,
+    };
+    memcpy(h.loops, p->loops, sizeof(h.loops));
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+
+    // Store the script path so that the image survives a change of directory
+    char abs[PATH_MAX];
+    if (realpath(p->src->path, abs) != NULL && strlen(abs) < sizeof(h.path)) {
+        strcpy(h.path, abs);
+    } else {
+        strcpy(h.path, p->src->path);
+    }
+
+    uint16_t pages[PAGE_TBL_SIZE];
+    h.n_pages = _checkpoint_resident_pages(p, pages);
+    char *var, *value;
+    for (int i = 0; mem_next_var(p->pid, &i, &var, &value); ) { h.n_vars++; }
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL) { return CHECKPOINT_IO_ERROR; }
+
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1
+        && fwrite(pages, sizeof(uint16_t), h.n_pages, f) == h.n_pages;
+    for (int i = 0; ok && mem_next_var(p->pid, &i, &var, &value); ) {
+        ok = _checkpoint_write_str(f, var) && _checkpoint_write_str(f, value);
+    }
+    if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return CHECKPOINT_IO_ERROR;
+    }
+    return CHECKPOINT_OK;
+}
+
+// Recreate a process from a checkpoint image, under a new PID. The caller
+// admits it to a scheduler.
+enum CheckpointStatus checkpoint_restore(const char *path, struct pcb **restored) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) { return CHECKPOINT_IO_ERROR; }
+
+    struct CheckpointHeader h;
+    uint16_t pages[PAGE_TBL_SIZE];
+    int ok = fread(&h, sizeof(h), 1, f) == 1
+        && memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) == 0
+        && memchr(h.path, '\0', sizeof(h.path)) != NULL
+        && h.n_pages <= PAGE_TBL_SIZE
+        && h.n_loops <= CODESOURCE_LOOP_DEPTH
+        && fread(pages, sizeof(uint16_t), h.n_pages, f) == h.n_pages;
+    if (!ok) {
+        fclose(f);
+        return CHECKPOINT_IO_ERROR;
+    }
+
+    // The script must be the one that was running
+    struct CodeSource *src = codesource_open(h.path);
+    if (src == NULL) {
+        fclose(f);
+        return CHECKPOINT_NO_SCRIPT;
+    }
+    if (src->dev != h.dev || src->ino != h.ino || src->size != h.size
+        || src->mtime.tv_sec != h.mtime_sec || src->mtime.tv_nsec != h.mtime_nsec) {
+        codesource_release(src);
+        fclose(f);
+        return CHECKPOINT_SCRIPT_CHANGED;
+    }
+
+    // Preload the hot pages, as many as fit
+    spid_t pid = generate_pid();
+    page_tbl_t *pt = page_tbl_new();
+    for (int i = 0; i < h.n_pages && i < N_FRAMES; i++) {
+        frame_num_t frame = load_page(src, pages[i], pid, memgroup_current());
+        if (frame != UNKNOWN_FRAME) { page_tbl_set(pt, pages[i], frame); }
+    }
+    struct pcb *p = pcb_new(pid, pt, src);
+    p->pc = h.pc;
+    p->n_loops = h.n_loops;
+    memcpy(p->loops, h.loops, sizeof(p->loops));
+    codesource_release(src);
+
+    // Variables
+    for (int i = 0; i < h.n_vars; i++) {
+        char *var = _checkpoint_read_str(f);
+        char *value = var == NULL ? NULL : _checkpoint_read_str(f);
+        if (value != NULL) { mem_set_value_pid(pid, var, value); }
+        free(var);
+        free(value);
+    }
+    fclose(f);
+
+    *restored = p;
+    return CHECKPOINT_OK;
+}
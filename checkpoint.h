@@ -0,0 +1,44 @@
+/*
+ *  Process checkpoint images.
+ *  An image holds a process's program counter and open repeat blocks, the
+ *  identity of its script, the pages it had resident (most recently used
+ *  first) and its variables.
+ *  Restoring re-reads the pages from the script, which must be unchanged, and
+ *  preloads them so the process resumes without faulting its working set in.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "utiltypes.h"
+#include "pcb.h"
+
+#define CHECKPOINT_MAGIC "MYSHCKP2"
+
+enum CheckpointStatus {
+    CHECKPOINT_OK,
+    CHECKPOINT_IO_ERROR,            // unreadable, unwritable or malformed image
+    CHECKPOINT_NO_SCRIPT,           // the script cannot be opened
+    CHECKPOINT_SCRIPT_CHANGED,      // the script is not the one checkpointed
+    CHECKPOINT_STREAMED,            // the script was streamed and cannot be read again
+};
+
+struct CheckpointHeader {
+    char magic[sizeof(CHECKPOINT_MAGIC) - 1];
+    uint32_t pid;                   // when checkpointed (informational)
+    uint32_t pc;                    // next line to run
+    uint32_t n_loops;               // repeat blocks the process is inside
+    struct LoopFrame loops[CODESOURCE_LOOP_DEPTH];
+    char path[CMD_MAX_CHARS];       // absolute when it fits
+    uint64_t dev;                   // script identity
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint16_t n_pages;               // resident pages (uint16_t each) follow
+    uint16_t n_vars;                // then length-prefixed name/value pairs
+};
+
+enum CheckpointStatus checkpoint_save(struct pcb *p, const char *path);
+enum CheckpointStatus checkpoint_restore(const char *path, struct pcb **restored);
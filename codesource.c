@@ -0,0 +1,434 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codesource.h"
+#include "output.h"
+#include "simdscan.h"
+
+int codesource_use_mmap = 1;
+struct CodeSource *codesource_cache = NULL;     // most recently opened first
+unsigned long codesource_last_id = 0;
+struct CodeSource *codesource_stdin = NULL;     // source streaming standard input, if any
+
+void _codesource_throw_error(const char *msg) {
+    output_printf("codesource: Runtime error: %s\n", msg);
+    exit(99);
+}
+
+// Choose between mapping scripts and reading them with pread()
+void codesource_set_mmap(int enabled) {
+    codesource_use_mmap = enabled;
+}
+
+// 1 if a cached source still describes the file
+int _codesource_matches(struct CodeSource *src, struct stat *st) {
+    return src->dev == st->st_dev && src->ino == st->st_ino && src->size == st->st_size
+        && src->mtime.tv_sec == st->st_mtim.tv_sec && src->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Make room for `lines` lines and the end offset
+void _codesource_reserve(struct CodeSource *src, size_t lines) {
+    if (lines + 1 <= src->cap) { return; }
+    size_t cap = lines + 1 > 2 * src->cap ? lines + 1 : 2 * src->cap;
+    src->line_offsets = realloc(src->line_offsets, cap * sizeof(size_t));
+    if (src->loops != NULL) {
+        src->loops = realloc(src->loops, cap * sizeof(struct CodeLoop));
+        for (size_t i = src->cap; i < cap; i++) { src->loops[i] = (struct CodeLoop) { -1, 0 }; }
+    }
+    src->cap = cap;
+}
+
+// Record where the lines in buf start. buf holds the file from offset base.
+void _codesource_index(struct CodeSource *src, const char *buf, size_t len, size_t base) {
+    // Room for one line per newline
+    _codesource_reserve(src, src->n_lines + scan_count_byte(buf, len, '\n'));
+    src->n_lines += scan_newline_offsets(buf, len, base, src->line_offsets + src->n_lines);
+
+    // A newline at the very end of the file does not start a line
+    if (src->n_lines > 0 && src->line_offsets[src->n_lines - 1] >= (size_t) src->size) { src->n_lines--; }
+}
+
+// Build the line index of a source. Return 0 on success.
+int _codesource_build_index(struct CodeSource *src) {
+    _codesource_reserve(src, 64);
+    src->n_lines = 0;
+    if (src->size > 0) { src->line_offsets[src->n_lines++] = 0; }
+
+    if (src->data != NULL) {
+        _codesource_index(src, src->data, src->size, 0);
+    } else {
+        char buf[CODESOURCE_READ_CHUNK];
+        size_t base = 0;
+        ssize_t n;
+        while ((n = pread(src->fd, buf, sizeof(buf), base)) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) { continue; }
+                return 1;
+            }
+            _codesource_index(src, buf, n, base);
+            base += n;
+        }
+    }
+
+    src->line_offsets[src->n_lines] = src->size;    // end of the last line
+    return 0;
+}
+
+// Read the start of a line (at most CODESOURCE_LOOP_PEEK - 1 bytes) into buf
+size_t _codesource_peek_line(struct CodeSource *src, size_t line, char *buf) {
+    size_t start = src->line_offsets[line];
+    size_t len = src->line_offsets[line + 1] - start;
+    if (len > CODESOURCE_LOOP_PEEK - 1) { len = CODESOURCE_LOOP_PEEK - 1; }
+    if (src->data != NULL) {
+        memcpy(buf, src->data + start, len);
+    } else {
+        ssize_t n;
+        while ((n = pread(src->fd, buf, len, start)) < 0 && errno == EINTR);
+        len = n < 0 ? 0 : n;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+// Match repeat N / end lines indexed since the last call. A repeat waits for
+// its end as pending; unmatched or too deeply nested ones are left alone, to
+// fail as unknown commands.
+void _codesource_resolve_loops(struct CodeSource *src) {
+    for (size_t line = src->loops_resolved; line < src->n_lines; line++) {
+        char buf[CODESOURCE_LOOP_PEEK], word[CODESOURCE_LOOP_PEEK], rest;
+        unsigned long count;
+        _codesource_peek_line(src, line, buf);
+        if (sscanf(buf, "%31s", word) != 1) { continue; }
+
+        if (strcmp(word, "repeat") == 0 && sscanf(buf, " repeat %lu %c", &count, &rest) == 1 && count <= UINT32_MAX) {
+            if (src->loop_depth == CODESOURCE_LOOP_DEPTH) {
+                src->loops_skipped++;
+                continue;
+            }
+            if (src->loops == NULL) {
+                src->loops = malloc(src->cap * sizeof(struct CodeLoop));
+                for (size_t i = 0; i < src->cap; i++) { src->loops[i] = (struct CodeLoop) { -1, 0 }; }
+            }
+            src->loops[line] = (struct CodeLoop) { CODESOURCE_LOOP_PENDING, count };
+            src->loop_open[src->loop_depth++] = line;
+        } else if (strcmp(word, "end") == 0 && sscanf(buf, " end %c", &rest) != 1 && src->loops_skipped > 0) {
+            src->loops_skipped--;   // closes a skipped repeat
+        } else if (strcmp(word, "end") == 0 && sscanf(buf, " end %c", &rest) != 1 && src->loop_depth > 0) {
+            size_t start = src->loop_open[--src->loop_depth];
+            src->loops[start].match = line;
+            src->loops[line].match = start;
+        }
+    }
+    src->loops_resolved = src->n_lines;
+}
+
+// The whole script is indexed: repeats still open have no end
+void _codesource_close_loops(struct CodeSource *src) {
+    while (src->loop_depth > 0) { src->loops[src->loop_open[--src->loop_depth]].match = -1; }
+    src->loops_skipped = 0;
+}
+
+void _codesource_destroy(struct CodeSource *src) {
+    // Unlink from the cache
+    for (struct CodeSource **link = &codesource_cache; *link != NULL; link = &(*link)->next) {
+        if (*link == src) {
+            *link = src->next;
+            break;
+        }
+    }
+    if (src->data != NULL) { munmap((void *) src->data, src->size); }
+    if (src->fd >= 0) { close(src->fd); }
+    if (src->stream_fd >= 0 && src->stream_fd != STDIN_FILENO) { close(src->stream_fd); }
+    if (src == codesource_stdin) { codesource_stdin = NULL; }
+    free(src->line_offsets);
+    free(src->loops);
+    free(src);
+}
+
+// Drop unreferenced sources beyond the cache limit, least recently opened first
+void _codesource_trim_cache() {
+    int kept = 0;
+    struct CodeSource *src = codesource_cache;
+    while (src != NULL) {
+        struct CodeSource *next = src->next;
+        if (src->refs == 0 && ++kept > CODESOURCE_CACHE_MAX) { _codesource_destroy(src); }
+        src = next;
+    }
+}
+
+// Append bytes to the backing file of a streamed script
+void _codesource_append(struct CodeSource *src, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = pwrite(src->fd, buf, len, src->size);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { _codesource_throw_error("could not write the backing file of a streamed script."); }
+        buf += n;
+        len -= n;
+        src->size += n;
+    }
+}
+
+// Bytes the shell's stdio has already read ahead from standard input
+size_t _codesource_stdin_buffered() {
+#ifdef __GLIBC__
+    return stdin->_IO_read_end - stdin->_IO_read_ptr;
+#else
+    return 0;
+#endif
+}
+
+// The whole of a streamed script is in: a last line without a newline counts
+void _codesource_end_stream(struct CodeSource *src) {
+    if ((size_t) src->size > src->line_offsets[src->n_lines]) {
+        _codesource_reserve(src, src->n_lines + 1);
+        src->line_offsets[++src->n_lines] = src->size;
+        _codesource_resolve_loops(src);
+    }
+    _codesource_close_loops(src);
+    if (src->stream_fd != STDIN_FILENO) { close(src->stream_fd); }
+    src->stream_fd = -1;
+}
+
+// Read whatever a streamed script has available into its backing file, without
+// blocking. Only complete lines are indexed; the rest waits in the backing file
+// for its newline. Return 1 if anything came in or the stream ended.
+// Standard input is shared with the shell, so it is never made non-blocking:
+// it is read only once poll() reports it readable, after what stdio buffered.
+int _codesource_stream_more(struct CodeSource *src) {
+    char buf[CODESOURCE_READ_CHUNK];
+    ssize_t n;
+    size_t buffered = src->stream_fd == STDIN_FILENO ? _codesource_stdin_buffered() : 0;
+    if (buffered > 0) {
+        n = fread(buf, 1, buffered < sizeof(buf) ? buffered : sizeof(buf), stdin);
+    } else {
+        // A FIFO no writer has opened yet polls as empty, not as ended
+        struct pollfd pfd = { .fd = src->stream_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 0) <= 0) { return 0; }
+        while ((n = read(src->stream_fd, buf, sizeof(buf))) < 0 && errno == EINTR);
+        if (n < 0 && errno == EAGAIN) { return 0; }
+    }
+    if (n <= 0) {
+        _codesource_end_stream(src);
+        return 1;
+    }
+
+    size_t base = src->size;
+    _codesource_append(src, buf, n);
+    _codesource_reserve(src, src->n_lines + scan_count_byte(buf, n, '\n'));
+    src->n_lines += scan_newline_offsets(buf, n, base, src->line_offsets + src->n_lines + 1);
+    _codesource_resolve_loops(src);
+    return 1;
+}
+
+// Start streaming a pipe, a FIFO or standard input ("-"). Nothing is read yet.
+struct CodeSource *_codesource_open_stream(const char *path) {
+    int is_stdin = strcmp(path, "-") == 0;
+    if (is_stdin && codesource_stdin != NULL && codesource_stdin->stream_fd >= 0) {
+        // exec - - ... runs the same script twice
+        codesource_ref(codesource_stdin);
+        return codesource_stdin;
+    }
+
+    char backing[] = "/tmp/mysh-stream-XXXXXX";
+    int fd = mkstemp(backing);
+    if (fd < 0) { return NULL; }
+    unlink(backing);
+    // Opening a FIFO without O_NONBLOCK would wait for a writer
+    int stream_fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if (stream_fd < 0 || fstat(fd, &st) != 0) {
+        if (stream_fd >= 0 && !is_stdin) { close(stream_fd); }
+        close(fd);
+        return NULL;
+    }
+
+    struct CodeSource *new = calloc(1, sizeof(struct CodeSource));
+    new->id = ++codesource_last_id;
+    strcpy(new->path, path);
+    new->dev = st.st_dev;           // the backing file's identity, never that of another script
+    new->ino = st.st_ino;
+    new->mtime = st.st_mtim;
+    new->fd = fd;
+    new->streamed = 1;
+    new->stream_fd = stream_fd;
+    new->stale = 1;                 // never handed out again
+    _codesource_reserve(new, 64);
+    new->line_offsets[0] = 0;
+    if (is_stdin) { codesource_stdin = new; }
+
+    new->refs = 1;
+    new->next = codesource_cache;
+    codesource_cache = new;
+    return new;
+}
+
+// 1 if a path names a script that is streamed rather than indexed up front:
+// standard input ("-"), a FIFO or a character device
+int codesource_is_stream(const char *path) {
+    struct stat st;
+    if (strcmp(path, "-") == 0) { return 1; }
+    return stat(path, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode));
+}
+
+// Open a script, reusing the cached index and mapping while the file is
+// unchanged. Return a referenced source, or NULL if the file cannot be read.
+struct CodeSource *codesource_open(const char *path) {
+    struct stat st;
+    if (strlen(path) >= CMD_MAX_CHARS) { return NULL; }
+    if (strcmp(path, "-") == 0) { return _codesource_open_stream(path); }
+    if (stat(path, &st) != 0) { return NULL; }
+    if (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode)) { return _codesource_open_stream(path); }
+    if (!S_ISREG(st.st_mode)) { return NULL; }
+
+    // Look for the file in the cache
+    for (struct CodeSource *src = codesource_cache; src != NULL; src = src->next) {
+        if (src->stale || src->dev != st.st_dev || src->ino != st.st_ino) { continue; }
+        if (_codesource_matches(src, &st)) {
+            codesource_ref(src);
+            return src;
+        }
+        // The file was modified: keep the old contents for whoever still uses them
+        src->stale = 1;
+        if (src->refs == 0) { _codesource_destroy(src); }
+        break;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { return NULL; }
+
+    struct CodeSource *new = calloc(1, sizeof(struct CodeSource));
+    new->id = ++codesource_last_id;
+    strcpy(new->path, path);
+    new->dev = st.st_dev;
+    new->ino = st.st_ino;
+    new->size = st.st_size;
+    new->mtime = st.st_mtim;
+    new->fd = fd;
+    new->stream_fd = -1;
+
+    if (codesource_use_mmap && new->size > 0) {
+        void *data = mmap(NULL, new->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            new->data = data;
+            close(fd);
+            new->fd = -1;
+        }
+        // otherwise fall back to pread()
+    }
+
+    if (_codesource_build_index(new)) {
+        _codesource_destroy(new);
+        return NULL;
+    }
+    _codesource_resolve_loops(new);
+    _codesource_close_loops(new);
+
+    new->refs = 1;
+    new->next = codesource_cache;
+    codesource_cache = new;
+    _codesource_trim_cache();
+    return new;
+}
+
+void codesource_ref(struct CodeSource *src) {
+    src->refs++;
+}
+
+void codesource_release(struct CodeSource *src) {
+    if (src == NULL) { return; }
+    if (--src->refs == 0 && src->stale) { _codesource_destroy(src); }
+}
+
+// Pages of the script. While a script is streaming in, only whole pages count.
+size_t codesource_n_pages(struct CodeSource *src) {
+    if (src->stream_fd >= 0) { return src->n_lines / PAGE_SIZE; }
+    return (src->n_lines + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+// 1 if the script has the page
+int codesource_has_page(struct CodeSource *src, page_num_t page) {
+    return page >= 0 && (size_t) page < codesource_n_pages(src);
+}
+
+// 1 if a page can be faulted in without waiting for the stream: the script is
+// not streaming any more, or the page has come in whole
+int codesource_page_ready(struct CodeSource *src, page_num_t page) {
+    if (src->stream_fd < 0 || codesource_has_page(src, page)) { return 1; }
+    _codesource_stream_more(src);
+    return src->stream_fd < 0 || codesource_has_page(src, page);
+}
+
+// Read what a streamed script has available. Return 1 if a process waiting on
+// it may go on: something came in or the stream ended.
+int codesource_stream_ready(struct CodeSource *src) {
+    return src->stream_fd < 0 || _codesource_stream_more(src);
+}
+
+// Block until one of the scripts still streaming in has input or ends
+void codesource_wait_streams() {
+    int n = 0;
+    for (struct CodeSource *src = codesource_cache; src != NULL; src = src->next) { n += src->stream_fd >= 0; }
+    if (n == 0) { return; }
+    if (codesource_stdin != NULL && codesource_stdin->stream_fd >= 0 && _codesource_stdin_buffered() > 0) { return; }
+
+    struct pollfd *fds = calloc(n, sizeof(struct pollfd));
+    n = 0;
+    for (struct CodeSource *src = codesource_cache; src != NULL; src = src->next) {
+        if (src->stream_fd >= 0) { fds[n++] = (struct pollfd) { .fd = src->stream_fd, .events = POLLIN }; }
+    }
+    while (poll(fds, n, -1) < 0 && errno == EINTR);
+    free(fds);
+}
+
+// The loop a line opens or closes, NULL if it is not a repeat/end line. A
+// streamed repeat line stays pending (match CODESOURCE_LOOP_PENDING) until its
+// end comes in.
+struct CodeLoop *codesource_loop(struct CodeSource *src, size_t line) {
+    if (src->loops == NULL || line >= src->n_lines) { return NULL; }
+    if (src->loops[line].match == CODESOURCE_LOOP_PENDING) { _codesource_stream_more(src); }
+    if (src->loops[line].match == -1) { return NULL; }
+    return &src->loops[line];
+}
+
+// Fill the lines of one page. Mapped sources are referenced in place, others
+// are read into `copy`. Lines past the end of the script are set to NULL, and
+// lines are cut to fit CMD_MAX_CHARS. Return 1 if the page is past the end.
+// Streamed scripts are never read here: see codesource_page_ready().
+int codesource_fill_page(struct CodeSource *src, page_num_t page, struct LineSpan *lines, char (*copy)[CMD_MAX_CHARS]) {
+    size_t first = (size_t) page * PAGE_SIZE;
+    if (page < 0 || first >= src->n_lines) { return 1; }
+
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        size_t line = first + i;
+        if (line >= src->n_lines) {
+            lines[i] = (struct LineSpan) { NULL, 0 };
+            continue;
+        }
+        size_t start = src->line_offsets[line];
+        size_t len = src->line_offsets[line + 1] - start;
+        if (len > CMD_MAX_CHARS - 1) { len = CMD_MAX_CHARS - 1; }
+
+        if (src->data != NULL) {
+            lines[i] = (struct LineSpan) { src->data + start, len };
+        } else {
+            ssize_t n;
+            while ((n = pread(src->fd, copy[i], len, start)) < 0 && errno == EINTR);
+            if (n < 0) { _codesource_throw_error("could not read code file."); }
+            copy[i][n] = '\0';
+            lines[i] = (struct LineSpan) { copy[i], n };
+        }
+    }
+    return 0;
+}
+
+// Close every source (at shell termination)
+void codesource_close_all() {
+    while (codesource_cache != NULL) { _codesource_destroy(codesource_cache); }
+}
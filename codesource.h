@@ -0,0 +1,74 @@
+/*
+ *  Script files backing the frame store.
+ *  A script is opened once and indexed by line. Its pages are then served
+ *  straight out of a read-only mapping, or with pread() when mapping is
+ *  disabled or impossible.
+ *
+ *  Pipes, FIFOs and standard input ("-") are streamed instead: input is read
+ *  as execution reaches it and appended to an unlinked backing file, which
+ *  evicted pages are read back from. A streamed script can start running
+ *  before its producer has finished writing it, and is never reused. Streams
+ *  are never read from in a way that blocks: a process whose next page (or
+ *  the end of a repeat block) has not come in yet waits, and the scheduler
+ *  runs the others meanwhile.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "utiltypes.h"
+
+#define CODESOURCE_CACHE_MAX 16     // unreferenced sources kept around for reuse
+#define CODESOURCE_READ_CHUNK (64 * 1024)
+#define CODESOURCE_LOOP_DEPTH 8     // nested repeat blocks
+#define CODESOURCE_LOOP_PEEK 32     // bytes of a line read to recognize repeat/end
+#define CODESOURCE_LOOP_PENDING -2  // match of a streamed repeat line whose end is not read yet
+
+// A repeat N ... end block, resolved when the script is indexed. Both lines
+// point at each other.
+struct CodeLoop {
+    int32_t match;                  // line of the matching repeat/end, -1 for other lines (or pending)
+    uint32_t count;                 // N, on the repeat line
+};
+
+struct CodeSource {
+    unsigned long id;               // unique for the life of the shell
+    char path[CMD_MAX_CHARS];       // as given when first opened
+    dev_t dev;                      // file identity
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    const char *data;               // mapped contents, NULL in read mode
+    int fd;                         // open in read mode, -1 otherwise
+    size_t *line_offsets;           // start of each line, then the end of the file
+    size_t n_lines;
+    size_t cap;                     // entries allocated in line_offsets (and loops)
+    struct CodeLoop *loops;         // by line, NULL if the script has no loops
+    size_t loop_open[CODESOURCE_LOOP_DEPTH];  // repeat lines whose end is not indexed yet
+    int loop_depth;
+    int loops_skipped;              // repeats nested too deeply, whose ends are left unmatched
+    size_t loops_resolved;          // lines already matched
+    int streamed;                   // read from a pipe or stdin, fd is the backing file
+    int stream_fd;                  // still being read, -1 once the whole script is in
+    int refs;                       // processes and frames using the source
+    int stale;                      // file changed since, no longer handed out
+    struct CodeSource *next;        // cache chain
+};
+
+void codesource_set_mmap(int enabled);
+struct CodeSource *codesource_open(const char *path);
+void codesource_ref(struct CodeSource *src);
+void codesource_release(struct CodeSource *src);
+size_t codesource_n_pages(struct CodeSource *src);
+int codesource_has_page(struct CodeSource *src, page_num_t page);
+int codesource_is_stream(const char *path);
+int codesource_page_ready(struct CodeSource *src, page_num_t page);
+int codesource_stream_ready(struct CodeSource *src);
+void codesource_wait_streams();
+struct CodeLoop *codesource_loop(struct CodeSource *src, size_t line);
+int codesource_fill_page(struct CodeSource *src, page_num_t page, struct LineSpan *lines, char (*copy)[CMD_MAX_CHARS]);
+void codesource_close_all();
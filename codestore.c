@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,15 +8,46 @@
 #include "pagetbl.h"
 #include "accessrecord.h"
 #include "scheduler.h"
+#include "output.h"
+#include "events.h"
+#include "ztier.h"
+#include "profile.h"
+#include "frameshm.h"
+#include "vtime.h"
+#include "symtab.h"
+#include "latency.h"
+#include "probes.h"
+#include "memgroup.h"
 
-char framestore[MEMORY_MAX_LINES][CMD_MAX_CHARS];
+char framestore[MEMORY_MAX_LINES][CMD_MAX_CHARS];     // line copies for sources that are not mapped
+struct LineSpan frame_lines[MEMORY_MAX_LINES];      // what each frame line holds
+struct FrameInfo frame_info[N_FRAMES];
 struct AccessRecord access_record = {
     .oldest = NULL,
     .newest = NULL,
 };
 
+// Resident frames by content hash, so identical pages of different scripts
+// (or offsets) share a frame
+struct {
+    int enabled;
+    frame_num_t heads[DEDUP_BUCKETS];   // chains of frame + 1, 0 ends a chain
+    frame_num_t next[N_FRAMES];
+    uint64_t hashes[N_FRAMES];
+    unsigned char indexed[N_FRAMES];
+    unsigned int shares[N_FRAMES];      // loads served by the frame after the first
+    unsigned long lookups;
+    unsigned long hits;
+
+    // Page being read
+    struct LineSpan lines[FRAME_SIZE];
+    char copy[FRAME_SIZE][CMD_MAX_CHARS];
+} dedup = {
+    .enabled = 1,
+};
+
 void _codestore_throw_error(const char *msg) {
-    printf("codestore: Runtime error: %s\n", msg);
+    output_printf("codestore: Runtime error: %s\n", msg);
     exit(99);
 }
 
@@ -34,6 +66,8 @@ int _get_line_by_frame(int n) {
 void init_code_store() {
     // Zero the code store
     memset(framestore, 0, sizeof(framestore));
+    memset(frame_lines, 0, sizeof(frame_lines));
+    memset(frame_info, 0, sizeof(frame_info));
 }
 
 // Get a frame without triggering an access record update
@@ -41,70 +75,288 @@ frame_t _get_frame_no_touch(frame_num_t frame) {
     if (frame >= N_FRAMES || frame < 0) {
         _codestore_throw_error("frame number out of bounds.");
     }
-    return &framestore[_get_line_by_frame(frame)];
+    return &frame_lines[_get_line_by_frame(frame)];
 }
 
 // Get a frame from the frame store
 frame_t get_frame(frame_num_t frame, spid_t caller) {
-    accessrecord_frame_used(&access_record, frame, caller);
+    if (frameshm_enabled()) {
+        frameshm_touch(frame, caller);
+    } else {
+        accessrecord_frame_used(&access_record, frame, caller);
+    }
     return _get_frame_no_touch(frame);
 }
 
 // Get a line from a frame
-char *frame_get_line(frame_t frame, int line_n) {
+struct LineSpan *frame_get_line(frame_t frame, int line_n) {
     if (line_n >= FRAME_SIZE || line_n < 0) {
         _codestore_throw_error("tried to get a line from a frame with out-of-bounds index.");
     }
-    return frame[line_n];
+    return &frame[line_n];
 }
 
-// Evict least recently used frame
-frame_num_t _evict_frame() {
-    frame_num_t new_frame = accessrecord_get_lru(&access_record);
+// Policy of the running scheduler, for probes
+enum Policy _codestore_policy() {
+    struct Scheduler *sch = get_running_scheduler();
+    return sch != NULL ? sch->policy : NULL_POLICY;
+}
+
+// The frame's group allows it to be evicted for a page of group *ctx
+int _evictable(frame_num_t frame, void *ctx) {
+    return memgroup_may_evict(frame_info[frame].group, *(int *) ctx);
+}
+
+// Evict the least recently used frame the group's quotas allow. There always
+// is one, since the minimums leave a frame unprotected.
+frame_num_t _evict_frame(int group) {
+    uint64_t start = latency_now();
+    spid_t victim_owner;
+    frame_num_t victim = accessrecord_peek_lru_where(&access_record, _evictable, &group, &victim_owner);
+    if (victim == UNKNOWN_FRAME) { _codestore_throw_error("no frame may be evicted within the memory group quotas."); }
+    events_record(EVENT_EVICT, victim_owner, frame_info[victim].page, victim);
+    MYSH_PROBE4(evict, victim_owner, frame_info[victim].page, victim, _codestore_policy());
+    vtime_disk_request(VTIME_REQ_EVICT);
+
+    accessrecord_remove(&access_record, victim);
+    frame_num_t new_frame = victim;
+    memgroup_uncharge(frame_info[new_frame].group, 1);
+
+    // Keep a compressed copy, so that a refault need not read the file
+    ztier_store(frame_info[new_frame].src, frame_info[new_frame].page, _get_frame_no_touch(new_frame));
+
     // Only print output if a page fault occurs while the scheduler is running (don't
     // print output when loading scripts)
-    if (get_running_scheduler() != NULL) { 
-        printf("Victim page contents:\n\n");
+    if (get_running_scheduler() != NULL && !events_quiet()) { 
+        output_printf("Victim page contents:\n\n");
         for (int i = 0; i < PAGE_SIZE; i++) {
-            printf("%s", frame_get_line(_get_frame_no_touch(new_frame), i));
+            struct LineSpan *line = frame_get_line(_get_frame_no_touch(new_frame), i);
+            if (line->text != NULL) { output_write(line->text, line->len); }
         }
-        printf("\nEnd of victim page contents.");
+        output_printf("\nEnd of victim page contents.");
     }
+    latency_record(LATENCY_EVICT, latency_now() - start);
     return new_frame;
 }
 
-// Find the next empty frame.
-frame_num_t _find_empty_frame() {
-    for (int i = 0; i < N_FRAMES; i++) {
-        if (framestore[_get_line_by_frame(i)][0] == '\0') {
-            // First char of frame is a null char, frame must be empty
-            return i;
+// FNV-1a over the lines of a page, with their lengths and absent lines
+uint64_t _dedup_hash(struct LineSpan *lines) {
+    uint64_t hash = 14695981039346656037u;
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        size_t len = lines[i].text == NULL ? SIZE_MAX : lines[i].len;
+        for (int b = 0; b < 8; b++) { hash = (hash ^ ((len >> (8 * b)) & 0xff)) * 1099511628211u; }
+        for (size_t j = 0; lines[i].text != NULL && j < len; j++) {
+            hash = (hash ^ (unsigned char) lines[i].text[j]) * 1099511628211u;
+        }
+    }
+    return hash;
+}
+
+int _dedup_same(struct LineSpan *a, struct LineSpan *b) {
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        if ((a[i].text == NULL) != (b[i].text == NULL)) { return 0; }
+        if (a[i].text != NULL && (a[i].len != b[i].len || memcmp(a[i].text, b[i].text, a[i].len) != 0)) { return 0; }
+    }
+    return 1;
+}
+
+// Resident frame holding these lines, UNKNOWN_FRAME if there is none
+frame_num_t _dedup_find(uint64_t hash, struct LineSpan *lines) {
+    for (frame_num_t f = dedup.heads[hash & (DEDUP_BUCKETS - 1)]; f != 0; f = dedup.next[f - 1]) {
+        if (dedup.hashes[f - 1] == hash && _dedup_same(_get_frame_no_touch(f - 1), lines)) { return f - 1; }
+    }
+    return UNKNOWN_FRAME;
+}
+
+void _dedup_insert(frame_num_t frame, uint64_t hash) {
+    frame_num_t *head = &dedup.heads[hash & (DEDUP_BUCKETS - 1)];
+    dedup.hashes[frame] = hash;
+    dedup.next[frame] = *head;
+    dedup.shares[frame] = 0;
+    dedup.indexed[frame] = 1;
+    *head = frame + 1;
+}
+
+// Take a frame out of the index, before its contents change
+void _dedup_remove(frame_num_t frame) {
+    if (!dedup.indexed[frame]) { return; }
+    frame_num_t *link = &dedup.heads[dedup.hashes[frame] & (DEDUP_BUCKETS - 1)];
+    while (*link != frame + 1) { link = &dedup.next[*link - 1]; }
+    *link = dedup.next[frame];
+    dedup.indexed[frame] = 0;
+    dedup.shares[frame] = 0;
+}
+
+// Turn content deduplication of the local frame store on or off
+void codestore_set_dedup(int enabled) {
+    dedup.enabled = enabled;
+}
+
+// Find a frame to load a page of a group into: the next empty frame, unless
+// the group must replace one of its own.
+frame_num_t _find_empty_frame(int group) {
+    if (!memgroup_at_max(group)) {
+        for (int i = 0; i < N_FRAMES; i++) {
+            if (frame_info[i].src == NULL) { return i; }
         }
     }
     // No available frames, evict
-    return _evict_frame();
+    return _evict_frame(group);
+}
+
+// Intern the variables named by a newly loaded frame
+void _decode_frame(frame_t frame) {
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        if (frame[i].text != NULL) { symtab_decode_line(frame[i].text, frame[i].len); }
+    }
+}
+
+// Claim the frame another page is about to be loaded into, when the frame
+// store is shared. Called with the segment locked: the page it held is copied
+// to old, to be evicted once unlocked. Return 1 if this shell's copy of that
+// page is still current.
+int _claim_shared_frame(frame_num_t victim, struct FrameShmSlot *old) {
+    *old = *frameshm_slot(victim);
+    int current = frame_info[victim].src != NULL && frame_generation(victim) != 0;
+    frameshm_begin_load(victim);
+    return current;
 }
 
-// Load one page of a file into the frame store. Return the frame number.
-// Ensure input does not have error or EOF set.
-// Advance by `advance_to` pages before reading.
-frame_num_t load_page(FILE *input, spid_t owner) {
-    // Find a frame to load the file into
-    frame_num_t frame_n = _find_empty_frame();
+// Evict the page a claimed shared frame held, from the copy taken under the lock
+void _evict_shared_frame(frame_num_t victim, const struct FrameShmSlot *old, int current) {
+    if (old->state != FRAMESHM_READY) { return; }
+    uint64_t start = latency_now();
+    events_record(EVENT_EVICT, old->owner, old->page, victim);
+    MYSH_PROBE4(evict, old->owner, old->page, victim, _codestore_policy());
+    vtime_disk_request(VTIME_REQ_EVICT);
+
+    // Only a copy this shell still holds can go to the compressed tier
+    if (current) {
+        ztier_store(frame_info[victim].src, frame_info[victim].page, _get_frame_no_touch(victim));
+    }
+
+    if (get_running_scheduler() != NULL && !events_quiet()) {
+        output_printf("Victim page contents:\n\n");
+        for (int i = 0; i < PAGE_SIZE; i++) {
+            if (old->present[i]) { output_write(old->text[i], old->len[i]); }
+        }
+        output_printf("\nEnd of victim page contents.");
+    }
+    latency_record(LATENCY_EVICT, latency_now() - start);
+}
+
+// Load a page through the shared frame store: take it from whichever shell
+// loaded it, or load it into the shared LRU frame. The segment is only locked
+// to find and claim the frame and to publish it; the page is read in between.
+frame_num_t _load_shared_page(struct CodeSource *src, page_num_t page, spid_t owner) {
+    frameshm_lock();
+    frame_num_t frame_n = frameshm_find(src, page);
+    int hit = frame_n != UNKNOWN_FRAME;
+    if (!hit) {
+        struct FrameShmSlot old;
+        frame_n = frameshm_victim();
+        int current = _claim_shared_frame(frame_n, &old);
+        frameshm_unlock();
+        _evict_shared_frame(frame_n, &old, current);
+    }
+
+    frame_t frame = _get_frame_no_touch(frame_n);
+    char (*copy)[CMD_MAX_CHARS] = &framestore[_get_line_by_frame(frame_n)];
+    unsigned int gen;
+    if (hit) {
+        frameshm_copy_out(frame_n, frame, copy);
+        gen = frameshm_generation(frame_n);
+    } else {
+        if (!ztier_load(src, page, frame, copy)) {
+            codesource_fill_page(src, page, frame, copy);
+            vtime_disk_request(VTIME_REQ_PAGE_IN);
+        }
+        frameshm_lock();
+        gen = frameshm_publish(frame_n, src, page, frame);
+    }
+    frameshm_touch(frame_n, owner);
+    frameshm_unlock();
+    _decode_frame(frame);
+
+    // A copy this shell already had keeps the page tables mapping it
+    unsigned int refs = frame_info[frame_n].gen == gen ? frame_info[frame_n].refs : 0;
+    codesource_ref(src);
+    codesource_release(frame_info[frame_n].src);
+    frame_info[frame_n] = (struct FrameInfo) { .src = src, .page = page, .gen = gen, .refs = refs };
+    MYSH_PROBE4(page_load, owner, page, frame_n, _codestore_policy());
+
+    return frame_n;
+}
+
+// Record a frame's new contents. The frame keeps the source alive while it
+// refers to it.
+void _set_frame_info(frame_num_t frame_n, struct CodeSource *src, page_num_t page, int group) {
+    codesource_ref(src);
+    codesource_release(frame_info[frame_n].src);
+    frame_info[frame_n] = (struct FrameInfo) { .src = src, .page = page, .gen = page_tbl_next_gen(frame_info[frame_n].gen), .group = group };
+    memgroup_charge(group);
+}
+
+// Load a page into the local frame store, mapping a resident frame with the
+// same contents if there is one
+frame_num_t _load_page_dedup(struct CodeSource *src, page_num_t page, spid_t owner, int group) {
+    if (!ztier_load(src, page, dedup.lines, dedup.copy)) {
+        codesource_fill_page(src, page, dedup.lines, dedup.copy);
+        vtime_disk_request(VTIME_REQ_PAGE_IN);
+    }
+    uint64_t hash = _dedup_hash(dedup.lines);
+    dedup.lookups++;
+    frame_num_t frame_n = _dedup_find(hash, dedup.lines);
+    if (frame_n != UNKNOWN_FRAME) {
+        dedup.hits++;
+        dedup.shares[frame_n]++;
+        get_frame(frame_n, owner);
+        MYSH_PROBE4(page_load, owner, page, frame_n, _codestore_policy());
+        return frame_n;
+    }
+
+    frame_n = _find_empty_frame(group);
+    _dedup_remove(frame_n);
     frame_t frame = get_frame(frame_n, owner);  // also ensures the frame is updated in access record
 
-    // Load one page worth of lines into the frame
-    char *ret_val;
-    char *write_to;
+    // Lines read into the scratch copy move to the frame's own
+    char (*copy)[CMD_MAX_CHARS] = &framestore[_get_line_by_frame(frame_n)];
     for (int i = 0; i < FRAME_SIZE; i++) {
-        // Read file into frame line-by-line
-        write_to = frame_get_line(frame, i);
-        ret_val = fgets(write_to, CMD_MAX_CHARS - 1, input);
-        if (ret_val == NULL) {
-            // end of file, no characters
-            write_to[0] = '\0';  // set null char so the program knows where to stop
+        frame[i] = dedup.lines[i];
+        if (frame[i].text == dedup.copy[i]) {
+            memcpy(copy[i], dedup.copy[i], frame[i].len + 1);
+            frame[i].text = copy[i];
         }
     }
+    _decode_frame(frame);
+    _set_frame_info(frame_n, src, page, group);
+    _dedup_insert(frame_n, hash);
+    MYSH_PROBE4(page_load, owner, page, frame_n, _codestore_policy());
+
+    return frame_n;
+}
+
+// Load one page of a script into the frame store. Return the frame number,
+// or UNKNOWN_FRAME if the page is past the end of the script.
+frame_num_t load_page(struct CodeSource *src, page_num_t page, spid_t owner, int group) {
+    if (!codesource_has_page(src, page)) { return UNKNOWN_FRAME; }
+    if (frameshm_enabled()) { return _load_shared_page(src, page, owner); }
+
+    if (dedup.enabled) { return _load_page_dedup(src, page, owner, group); }
+
+    // Find a frame to load the page into
+    frame_num_t frame_n = _find_empty_frame(group);
+    frame_t frame = get_frame(frame_n, owner);  // also ensures the frame is updated in access record
+
+    // Point the frame at the page's lines (copied only if the source is not mapped)
+    char (*copy)[CMD_MAX_CHARS] = &framestore[_get_line_by_frame(frame_n)];
+    if (!ztier_load(src, page, frame, copy)) {
+        codesource_fill_page(src, page, frame, copy);
+        vtime_disk_request(VTIME_REQ_PAGE_IN);
+    }
+    _decode_frame(frame);
+    _set_frame_info(frame_n, src, page, group);
+    MYSH_PROBE4(page_load, owner, page, frame_n, _codestore_policy());
 
     return frame_n;
 }
@@ -115,15 +367,67 @@ void clear_frame(frame_num_t frame) {
         _codestore_throw_error("frame number out of bounds.");
     }
     memset(&framestore[_get_line_by_frame(frame)], 0, FRAME_SIZE * CMD_MAX_CHARS);
+    memset(&frame_lines[_get_line_by_frame(frame)], 0, FRAME_SIZE * sizeof(struct LineSpan));
+    if (frame_info[frame].src != NULL && !frameshm_enabled()) { memgroup_uncharge(frame_info[frame].group, 0); }
+    _dedup_remove(frame);
+    codesource_release(frame_info[frame].src);
+    // A shared frame is only dropped from this shell: 0 matches no generation there
+    unsigned int gen = frameshm_enabled() ? 0 : page_tbl_next_gen(frame_info[frame].gen);
+    frame_info[frame] = (struct FrameInfo) { .src = NULL, .page = -1, .gen = gen };
+}
+
+// Get the generation of a frame's contents. With a shared frame store, a frame
+// another shell has reloaded since this shell copied it has generation 0.
+unsigned int frame_generation(frame_num_t frame) {
+    if (frame >= N_FRAMES || frame < 0) {
+        _codestore_throw_error("frame number out of bounds.");
+    }
+    if (frameshm_enabled() && frameshm_generation(frame) != frame_info[frame].gen) { return 0; }
+    return frame_info[frame].gen;
+}
+
+// A page table started mapping a frame
+void frame_ref(frame_num_t frame) {
+    if (frame >= N_FRAMES || frame < 0) {
+        _codestore_throw_error("frame number out of bounds.");
+    }
+    frame_info[frame].refs++;
+}
+
+// A page table stopped mapping a frame
+void frame_unref(frame_num_t frame) {
+    if (frame >= N_FRAMES || frame < 0 || frame_info[frame].refs == 0) {
+        _codestore_throw_error("frame reference count underflow.");
+    }
+    frame_info[frame].refs--;
+}
+
+void codestore_print_stats() {
+    int used = 0, mapped = 0, shared = 0;
+    for (int i = 0; i < N_FRAMES; i++) {
+        int current = frame_generation(i) != 0 || !frameshm_enabled();
+        used += frameshm_enabled() ? frameshm_in_use(i) : frame_info[i].src != NULL;
+        mapped += current && frame_info[i].refs > 0;
+        shared += current && frame_info[i].refs > 1;
+    }
+    output_printf("frames: %d/%d in use, %d mapped, %d shared between page tables\n", used, N_FRAMES, mapped, shared);
+    if (!frameshm_enabled()) {
+        unsigned long saved = 0;
+        for (int i = 0; i < N_FRAMES; i++) { saved += dedup.shares[i]; }
+        output_printf("dedup: %s, %lu/%lu hits (%.1f%%), %lu frames saved\n", dedup.enabled ? "on" : "off",
+            dedup.hits, dedup.lookups, dedup.lookups ? 100.0 * dedup.hits / dedup.lookups : 0.0, saved);
+    }
+    frameshm_print_stats();
 }
 
-// Load a script
-page_tbl_t *load_script(FILE *script, spid_t owner) {
+// Load a script, preloading at most `budget` pages (chosen by its profile)
+page_tbl_t *load_script(struct CodeSource *script, spid_t owner, int group, int budget) {
     page_tbl_t *pt = page_tbl_new();
 
-    // Load at most two pages into shell memory
-    for (int i = 0; !feof(script) && !ferror(script) && i < INITIAL_PAGE_N; i++) {
-        page_tbl_set(pt, i, load_page(script, owner));
+    page_num_t pages[PAGE_TBL_SIZE];
+    int n = profile_preload_order(script, pages, budget < PAGE_TBL_SIZE ? budget : PAGE_TBL_SIZE);
+    for (int i = 0; i < n; i++) {
+        page_tbl_set(pt, pages[i], load_page(script, pages[i], owner, group));
     }
 
     return pt;
@@ -132,4 +436,6 @@ page_tbl_t *load_script(FILE *script, spid_t owner) {
 // Tasks to perform before termination
 void codestore_terminate() {
     accessrecord_empty(&access_record);
+    for (int i = 0; i < N_FRAMES; i++) { clear_frame(i); }
+    codesource_close_all();
 }
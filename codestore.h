@@ -5,13 +5,29 @@
 #include "utiltypes.h"
 #include "pcb.h"
 #include "pagetbl.h"
+#include "codesource.h"
 
 #define INITIAL_PAGE_N 2       // number of pages to load from a new process
+#define DEDUP_BUCKETS 1024     // content hash index of resident frames (power of two)
+
+// What a frame currently holds
+struct FrameInfo {
+    struct CodeSource *src;     // NULL if the frame is free
+    page_num_t page;
+    unsigned int gen;           // bumped whenever the frame is reused, invalidating old mappings
+    unsigned int refs;          // page tables mapping the current contents
+    int group;                  // memory group the frame is charged to
+};
 
 void init_code_store();
-int load_page(FILE *input, spid_t owner);
-char *frame_get_line(frame_t frame, int line_n);
+frame_num_t load_page(struct CodeSource *src, page_num_t page, spid_t owner, int group);
+struct LineSpan *frame_get_line(frame_t frame, int line_n);
 frame_t get_frame(frame_num_t frame, spid_t caller);
 void clear_frame(frame_num_t frame);
-page_tbl_t *load_script(FILE *script, spid_t owner);
+unsigned int frame_generation(frame_num_t frame);
+void frame_ref(frame_num_t frame);
+void frame_unref(frame_num_t frame);
+void codestore_set_dedup(int enabled);
+void codestore_print_stats();
+page_tbl_t *load_script(struct CodeSource *script, spid_t owner, int group, int budget);
 void codestore_terminate();
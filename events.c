@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "events.h"
+#include "output.h"
+
+struct {
+    int quiet;
+    uint64_t head;                  // total events ever recorded
+    uint64_t tail;                  // first event not yet drained
+    const char *dump_path;          // written at exit if set
+    struct PagingEvent ring[EVENT_RING_SIZE];
+} event_log;
+
+void events_set_quiet(int quiet) {
+    event_log.quiet = quiet;
+}
+
+// 1 if paging output is suppressed in favour of the ring buffer
+int events_quiet() {
+    return event_log.quiet;
+}
+
+void events_record(enum PagingEventType type, spid_t pid, page_num_t page, frame_num_t frame) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    event_log.ring[event_log.head & (EVENT_RING_SIZE - 1)] = (struct PagingEvent) {
+        .timestamp_ns = (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec,
+        .type = type,
+        .pid = pid,
+        .page = page,
+        .frame = frame,
+    };
+    event_log.head++;
+}
+
+// Oldest event still held in the ring
+uint64_t _events_first() {
+    uint64_t oldest = event_log.head > EVENT_RING_SIZE ? event_log.head - EVENT_RING_SIZE : 0;
+    return event_log.tail > oldest ? event_log.tail : oldest;
+}
+
+// Print undrained events, oldest first, and forget them
+void events_drain() {
+    uint64_t first = _events_first();
+    if (first > event_log.tail) {
+        output_printf("(%llu events lost)\n", (unsigned long long) (first - event_log.tail));
+    }
+    for (uint64_t i = first; i < event_log.head; i++) {
+        struct PagingEvent *e = &event_log.ring[i & (EVENT_RING_SIZE - 1)];
+        output_printf(
+            "%llu %s pid %u page %d frame %d\n",
+            (unsigned long long) e->timestamp_ns,
+            e->type == EVENT_PAGE_FAULT ? "fault" : "evict",
+            e->pid, e->page, e->frame
+        );
+    }
+    event_log.tail = event_log.head;
+}
+
+// Write held events to a file: magic, record count, then the records.
+// Return 0 on success.
+int events_dump(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) { return 1; }
+
+    uint64_t first = _events_first();
+    uint32_t count = event_log.head - first;
+    fwrite(EVENT_DUMP_MAGIC, 1, strlen(EVENT_DUMP_MAGIC), f);
+    fwrite(&count, sizeof(count), 1, f);
+    for (uint64_t i = first; i < event_log.head; i++) {
+        fwrite(&event_log.ring[i & (EVENT_RING_SIZE - 1)], sizeof(struct PagingEvent), 1, f);
+    }
+    return fclose(f) != 0;
+}
+
+void events_set_dump_path(const char *path) {
+    event_log.dump_path = path;
+}
+
+// atexit hook
+void events_dump_at_exit() {
+    if (event_log.dump_path != NULL && events_dump(event_log.dump_path)) {
+        fprintf(stderr, "events: could not write dump to '%s'\n", event_log.dump_path);
+    }
+}
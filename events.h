@@ -0,0 +1,36 @@
+/*
+ *  Structured paging events.
+ *  In quiet mode, page faults and evictions are only recorded here (not
+ *  printed), in a fixed-size ring buffer that keeps the newest events.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "utiltypes.h"
+
+#define EVENT_RING_SIZE 4096        // events kept (power of two)
+#define EVENT_DUMP_MAGIC "MYSHEVT1"
+
+enum PagingEventType {
+    EVENT_PAGE_FAULT = 1,
+    EVENT_EVICT = 2,
+};
+
+// Fixed binary layout, also used for dumps
+struct PagingEvent {
+    uint64_t timestamp_ns;          // CLOCK_MONOTONIC
+    uint32_t type;
+    uint32_t pid;
+    int32_t page;                   // -1 if unknown
+    int32_t frame;
+};
+
+void events_set_quiet(int quiet);
+int events_quiet();
+void events_record(enum PagingEventType type, spid_t pid, page_num_t page, frame_num_t frame);
+void events_drain();
+int events_dump(const char *path);
+void events_set_dump_path(const char *path);
+void events_dump_at_exit();
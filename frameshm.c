@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frameshm.h"
+#include "pagetbl.h"
+#include "output.h"
+
+struct {
+    const char *name;               // segment name, NULL when frames are private
+    char path[CMD_MAX_CHARS];       // name with the leading '/' shm_open() wants
+    struct FrameShm *shm;
+} frameshm = { 0 };
+
+void _frameshm_throw_error(const char *msg) {
+    output_printf("frameshm: Runtime error: %s\n", msg);
+    exit(99);
+}
+
+void frameshm_set_name(const char *name) {
+    frameshm.name = name;
+}
+
+int frameshm_enabled() {
+    return frameshm.shm != NULL;
+}
+
+// A shell that exited without detaching (killed) no longer needs the segment
+int _frameshm_alive(pid_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+// Forget shells that died. Called with the lock held.
+void _frameshm_prune() {
+    for (int i = 0; i < FRAMESHM_PROCS_MAX; i++) {
+        if (frameshm.shm->procs[i] != 0 && !_frameshm_alive(frameshm.shm->procs[i])) { frameshm.shm->procs[i] = 0; }
+    }
+}
+
+// Free the frames left loading by shells that died. Called with the lock held.
+void _frameshm_reclaim() {
+    for (int i = 0; i < N_FRAMES; i++) {
+        struct FrameShmSlot *s = &frameshm.shm->slots[i];
+        if (s->state != FRAMESHM_LOADING || _frameshm_alive(s->loader)) { continue; }
+        s->state = FRAMESHM_FREE;
+        s->loader = 0;
+        __atomic_store_n(&s->gen, page_tbl_next_gen(s->gen), __ATOMIC_RELEASE);
+        frameshm.shm->recoveries++;
+    }
+}
+
+// The previous holder of the lock died
+void _frameshm_recover() {
+    _frameshm_reclaim();
+    _frameshm_prune();
+}
+
+void frameshm_lock() {
+    int rc = pthread_mutex_lock(&frameshm.shm->lock);
+    if (rc == EOWNERDEAD) {
+        _frameshm_recover();
+        pthread_mutex_consistent(&frameshm.shm->lock);
+    } else if (rc != 0) {
+        _frameshm_throw_error("could not lock the shared frame store.");
+    }
+}
+
+void frameshm_unlock() {
+    pthread_mutex_unlock(&frameshm.shm->lock);
+}
+
+// Set up a segment this shell just created
+int _frameshm_format(struct FrameShm *shm) {
+    memset(shm, 0, sizeof(*shm));
+    memcpy(shm->magic, FRAMESHM_MAGIC, sizeof(shm->magic));
+    shm->bytes = sizeof(*shm);
+    shm->n_frames = N_FRAMES;
+    shm->frame_size = FRAME_SIZE;
+    shm->line_max = CMD_MAX_CHARS;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int rc = pthread_mutex_init(&shm->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) { return 1; }
+
+    __atomic_store_n(&shm->ready, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Wait for the shell that created the segment to finish setting it up
+int _frameshm_wait_ready(int fd) {
+    struct stat st;
+    for (int ms = 0; ms < FRAMESHM_ATTACH_WAIT; ms++) {
+        if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(struct FrameShm)) { return 0; }
+        usleep(1000);
+    }
+    return 1;
+}
+
+// Create or attach to the segment. Return 1 (after a message) on failure.
+int frameshm_open() {
+    if (frameshm.name == NULL) { return 0; }
+    snprintf(frameshm.path, sizeof(frameshm.path), "%s%s", frameshm.name[0] == '/' ? "" : "/", frameshm.name);
+
+    int created = 1;
+    int fd = shm_open(frameshm.path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = 0;
+        fd = shm_open(frameshm.path, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "frameshm: could not open shared memory '%s'\n", frameshm.path);
+        return 1;
+    }
+    if (created ? ftruncate(fd, sizeof(struct FrameShm)) != 0 : _frameshm_wait_ready(fd) != 0) {
+        fprintf(stderr, "frameshm: could not size shared memory '%s'\n", frameshm.path);
+        close(fd);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size != sizeof(struct FrameShm)) {
+        fprintf(stderr, "frameshm: '%s' was made by a build with a different frame store size\n", frameshm.path);
+        close(fd);
+        return 1;
+    }
+    struct FrameShm *shm = mmap(NULL, sizeof(struct FrameShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        fprintf(stderr, "frameshm: could not map '%s'\n", frameshm.path);
+        return 1;
+    }
+
+    if (created && _frameshm_format(shm)) {
+        fprintf(stderr, "frameshm: could not set up the lock in '%s'\n", frameshm.path);
+        munmap(shm, sizeof(*shm));
+        shm_unlink(frameshm.path);
+        return 1;
+    }
+    int ms = 0;
+    while (!__atomic_load_n(&shm->ready, __ATOMIC_ACQUIRE) && ms++ < FRAMESHM_ATTACH_WAIT) { usleep(1000); }
+    if (memcmp(shm->magic, FRAMESHM_MAGIC, sizeof(shm->magic)) != 0 || !shm->ready) {
+        fprintf(stderr, "frameshm: '%s' is not a shared frame store\n", frameshm.path);
+        munmap(shm, sizeof(*shm));
+        return 1;
+    }
+    if (shm->bytes != sizeof(*shm) || shm->n_frames != N_FRAMES || shm->frame_size != FRAME_SIZE || shm->line_max != CMD_MAX_CHARS) {
+        fprintf(stderr, "frameshm: '%s' was made by a build with a different frame store size\n", frameshm.path);
+        munmap(shm, sizeof(*shm));
+        return 1;
+    }
+    frameshm.shm = shm;
+
+    // Register, making room for it if shells were killed
+    frameshm_lock();
+    _frameshm_prune();
+    int slot = -1;
+    for (int i = 0; i < FRAMESHM_PROCS_MAX && slot < 0; i++) {
+        if (frameshm.shm->procs[i] == 0) { slot = i; }
+    }
+    if (slot >= 0) { frameshm.shm->procs[slot] = getpid(); }
+    frameshm_unlock();
+    if (slot < 0) {
+        fprintf(stderr, "frameshm: too many shells attached to '%s'\n", frameshm.path);
+        munmap(shm, sizeof(*shm));
+        frameshm.shm = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+// Detach (at exit). The last shell to leave removes the segment.
+void frameshm_close() {
+    if (frameshm.shm == NULL) { return; }
+
+    frameshm_lock();
+    int attached = 0;
+    for (int i = 0; i < FRAMESHM_PROCS_MAX; i++) {
+        if (frameshm.shm->procs[i] == getpid()) { frameshm.shm->procs[i] = 0; }
+    }
+    _frameshm_prune();
+    for (int i = 0; i < FRAMESHM_PROCS_MAX; i++) { attached += frameshm.shm->procs[i] != 0; }
+    if (attached == 0) { shm_unlink(frameshm.path); }
+    frameshm_unlock();
+
+    munmap(frameshm.shm, sizeof(*frameshm.shm));
+    frameshm.shm = NULL;
+}
+
+struct FrameShmSlot *frameshm_slot(frame_num_t frame) {
+    if (frame >= N_FRAMES || frame < 0) {
+        _frameshm_throw_error("frame number out of bounds.");
+    }
+    return &frameshm.shm->slots[frame];
+}
+
+// Find the frame holding a page of a script, UNKNOWN_FRAME if no shell has it
+// loaded. Called with the lock held.
+frame_num_t frameshm_find(struct CodeSource *src, page_num_t page) {
+    for (int i = 0; i < N_FRAMES; i++) {
+        struct FrameShmSlot *s = &frameshm.shm->slots[i];
+        if (s->state == FRAMESHM_READY && s->page == page && s->ino == src->ino && s->dev == src->dev
+                && s->size == src->size && s->mtime.tv_sec == src->mtime.tv_sec && s->mtime.tv_nsec == src->mtime.tv_nsec) {
+            frameshm.shm->hits++;
+            return i;
+        }
+    }
+    frameshm.shm->misses++;
+    return UNKNOWN_FRAME;
+}
+
+// Pick a frame to load into: a free one, else the least recently used by any
+// shell. Frames other shells are still loading are skipped. Called with the
+// lock held.
+frame_num_t frameshm_victim() {
+    frame_num_t victim = UNKNOWN_FRAME;
+    // Loads run without the lock, so their loader may have died since
+    _frameshm_reclaim();
+    for (int i = 0; i < N_FRAMES; i++) {
+        struct FrameShmSlot *s = &frameshm.shm->slots[i];
+        if (s->state == FRAMESHM_FREE) { return i; }
+        if (s->state == FRAMESHM_LOADING) { continue; }
+        if (victim == UNKNOWN_FRAME || s->last_use < frameshm.shm->slots[victim].last_use) { victim = i; }
+    }
+    if (victim == UNKNOWN_FRAME) { _frameshm_throw_error("no frame to load into."); }
+    return victim;
+}
+
+// Claim a frame for loading. The caller may then unlock to read the page;
+// until it is published, a crash leaves the frame to recovery.
+void frameshm_begin_load(frame_num_t frame) {
+    struct FrameShmSlot *s = frameshm_slot(frame);
+    s->state = FRAMESHM_LOADING;
+    s->loader = getpid();
+    __atomic_store_n(&s->gen, page_tbl_next_gen(s->gen), __ATOMIC_RELEASE);
+}
+
+// Publish the contents of a loaded frame. Return its new generation.
+unsigned int frameshm_publish(frame_num_t frame, struct CodeSource *src, page_num_t page, frame_t lines) {
+    struct FrameShmSlot *s = frameshm_slot(frame);
+    s->dev = src->dev;
+    s->ino = src->ino;
+    s->size = src->size;
+    s->mtime = src->mtime;
+    s->page = page;
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        s->present[i] = lines[i].text != NULL;
+        s->len[i] = s->present[i] ? lines[i].len : 0;
+        if (s->present[i]) { memcpy(s->text[i], lines[i].text, s->len[i]); }
+        s->text[i][s->len[i]] = '\0';
+    }
+    s->state = FRAMESHM_READY;
+    s->loader = 0;
+    unsigned int gen = page_tbl_next_gen(s->gen);
+    __atomic_store_n(&s->gen, gen, __ATOMIC_RELEASE);
+    return gen;
+}
+
+// Copy a frame's contents into private lines. Called with the lock held.
+void frameshm_copy_out(frame_num_t frame, frame_t lines, char (*copy)[CMD_MAX_CHARS]) {
+    struct FrameShmSlot *s = frameshm_slot(frame);
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        if (!s->present[i]) {
+            lines[i] = (struct LineSpan) { NULL, 0 };
+            continue;
+        }
+        memcpy(copy[i], s->text[i], s->len[i] + 1);
+        lines[i] = (struct LineSpan) { copy[i], s->len[i] };
+    }
+}
+
+unsigned int frameshm_generation(frame_num_t frame) {
+    return __atomic_load_n(&frameshm_slot(frame)->gen, __ATOMIC_ACQUIRE);
+}
+
+// Record an access for the shared LRU order (no lock needed)
+void frameshm_touch(frame_num_t frame, spid_t owner) {
+    struct FrameShmSlot *s = frameshm_slot(frame);
+    __atomic_store_n(&s->last_use, __atomic_add_fetch(&frameshm.shm->clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&s->owner, owner, __ATOMIC_RELAXED);
+}
+
+int frameshm_in_use(frame_num_t frame) {
+    return __atomic_load_n(&frameshm_slot(frame)->state, __ATOMIC_RELAXED) == FRAMESHM_READY;
+}
+
+void frameshm_print_stats() {
+    if (frameshm.shm == NULL) { return; }
+    frameshm_lock();
+    int attached = 0;
+    for (int i = 0; i < FRAMESHM_PROCS_MAX; i++) { attached += frameshm.shm->procs[i] != 0; }
+    output_printf("shared frames: %s, %d shells attached, %lu hits, %lu misses, %lu recovered\n",
+        frameshm.path, attached, frameshm.shm->hits, frameshm.shm->misses, frameshm.shm->recoveries);
+    frameshm_unlock();
+}
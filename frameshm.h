@@ -0,0 +1,90 @@
+/*
+ *  Frame store shared between shells.
+ *  With --shared-frames, frame contents, their identity and the replacement
+ *  state live in a POSIX shared-memory segment, so a page loaded by one mysh
+ *  is a hit in every other mysh attached to the same segment. Each shell keeps
+ *  a private copy of the frames it executes from; a frame reloaded by another
+ *  shell gets a new generation, which invalidates the local mappings of it.
+ *
+ *  The segment is guarded by one robust, process-shared mutex. A page is read
+ *  into a frame without holding it: the frame is marked as loading meanwhile,
+ *  so no other shell picks it, and one left loading by a shell that died is
+ *  freed again by the next shell looking for a frame.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "utiltypes.h"
+#include "codesource.h"
+
+#define FRAMESHM_MAGIC "MYSHFRM1"
+#define FRAMESHM_PROCS_MAX 64       // shells attached at once
+#define FRAMESHM_ATTACH_WAIT 1000   // ms to wait for another shell to set up the segment
+
+enum FrameShmState {
+    FRAMESHM_FREE,
+    FRAMESHM_LOADING,               // a shell is filling it (or died doing so)
+    FRAMESHM_READY,
+};
+
+struct FrameShmSlot {
+    unsigned int gen;               // bumped whenever the contents change, never 0 once loaded
+    int state;
+    pid_t loader;                   // shell filling the frame
+    spid_t owner;                   // last process to use the frame (in its own shell)
+    unsigned long long last_use;    // shared clock at the last access
+
+    // Page held
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    page_num_t page;
+
+    // Contents (present[i] is 0 past the end of the script)
+    char present[FRAME_SIZE];
+    unsigned int len[FRAME_SIZE];
+    char text[FRAME_SIZE][CMD_MAX_CHARS];
+};
+
+struct FrameShm {
+    char magic[8];
+    int ready;                      // set last by the shell that created the segment
+    size_t bytes;                   // geometry, checked on attach
+    unsigned int n_frames;
+    unsigned int frame_size;
+    unsigned int line_max;
+
+    pthread_mutex_t lock;
+    unsigned long long clock;
+    pid_t procs[FRAMESHM_PROCS_MAX];
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long recoveries;       // frames left half-loaded by dead shells
+
+    struct FrameShmSlot slots[N_FRAMES];
+};
+
+void frameshm_set_name(const char *name);
+int frameshm_enabled();
+int frameshm_open();
+void frameshm_close();
+
+void frameshm_lock();
+void frameshm_unlock();
+struct FrameShmSlot *frameshm_slot(frame_num_t frame);
+frame_num_t frameshm_find(struct CodeSource *src, page_num_t page);
+frame_num_t frameshm_victim();
+void frameshm_begin_load(frame_num_t frame);
+unsigned int frameshm_publish(frame_num_t frame, struct CodeSource *src, page_num_t page, frame_t lines);
+void frameshm_copy_out(frame_num_t frame, frame_t lines, char (*copy)[CMD_MAX_CHARS]);
+
+unsigned int frameshm_generation(frame_num_t frame);
+void frameshm_touch(frame_num_t frame, spid_t owner);
+int frameshm_in_use(frame_num_t frame);
+void frameshm_print_stats();
@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "fsops.h"
+#include "output.h"
+
+// Record layout returned by getdents64()
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct {
+    int cwd_fd;                     // working directory, -1 until needed
+    char dents[FS_DENTS_BUFFER] __attribute__((aligned(8)));
+
+    // Names of the listing in progress, reused across listings
+    char *arena;                    // FS_RUN_BYTES of packed names
+    size_t arena_used;
+    const char **names;
+    const char **aux;               // radix sort scratch
+    size_t n;
+    size_t cap;
+
+    // Sorted runs spilled to temporary files
+    FILE **runs;
+    size_t n_runs;
+    size_t runs_cap;
+} fs = {
+    .cwd_fd = -1,
+};
+
+void _fs_throw_error(const char *msg) {
+    output_printf("fsops: Runtime error: %s\n", msg);
+    exit(99);
+}
+
+// Descriptor of the working directory (AT_FDCWD if it cannot be opened)
+int _fs_cwd() {
+    if (fs.cwd_fd < 0) { fs.cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC); }
+    return fs.cwd_fd < 0 ? AT_FDCWD : fs.cwd_fd;
+}
+
+// Change directory, dropping the cached descriptor. Return 0 on success.
+int fs_chdir(const char *dir) {
+    if (chdir(dir) != 0) { return 1; }
+    if (fs.cwd_fd >= 0) { close(fs.cwd_fd); }
+    fs.cwd_fd = -1;
+    return 0;
+}
+
+// Create or truncate a file. Return 0 on success.
+int fs_touch(const char *name) {
+    int fd = openat(_fs_cwd(), name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) { return 1; }
+    close(fd);
+    return 0;
+}
+
+// Create a directory. Return 0 on success, -1 otherwise (as mkdir()).
+int fs_mkdir(const char *name) {
+    return mkdirat(_fs_cwd(), name, 0777);
+}
+
+// Compare from byte `depth` on, as strcmp() does
+int _fs_compare(const char *a, const char *b, size_t depth) {
+    return strcmp(a + depth, b + depth);
+}
+
+// MSD radix sort of names that agree on their first `depth` bytes
+void _fs_radix_sort(const char **v, const char **aux, size_t n, size_t depth) {
+    if (n < FS_RADIX_CUTOFF) {
+        for (size_t i = 1; i < n; i++) {
+            const char *s = v[i];
+            size_t j = i;
+            for (; j > 0 && _fs_compare(v[j - 1], s, depth) > 0; j--) { v[j] = v[j - 1]; }
+            v[j] = s;
+        }
+        return;
+    }
+
+    // Bucket by the byte at `depth` (bucket 0: names that end here, all equal)
+    size_t start[257] = { 0 };
+    for (size_t i = 0; i < n; i++) { start[(unsigned char) v[i][depth] + 1]++; }
+    for (int c = 1; c < 257; c++) { start[c] += start[c - 1]; }
+    size_t next[256];
+    memcpy(next, start, sizeof(next));
+    for (size_t i = 0; i < n; i++) { aux[next[(unsigned char) v[i][depth]]++] = v[i]; }
+    memcpy(v, aux, n * sizeof(*v));
+
+    for (int c = 1; c < 256; c++) {
+        size_t len = start[c + 1] - start[c];
+        if (len > 1) { _fs_radix_sort(v + start[c], aux, len, depth + 1); }
+    }
+}
+
+// Write the sorted names in memory out as a run, and start over
+void _fs_spill() {
+    FILE *f = tmpfile();
+    if (f == NULL) { _fs_throw_error("could not create a temporary file for sorting."); }
+    _fs_radix_sort(fs.names, fs.aux, fs.n, 0);
+    for (size_t i = 0; i < fs.n; i++) { fwrite(fs.names[i], 1, strlen(fs.names[i]) + 1, f); }
+    if (fflush(f) != 0 || fseek(f, 0, SEEK_SET) != 0) { _fs_throw_error("could not write a sorted run."); }
+
+    if (fs.n_runs == fs.runs_cap) {
+        fs.runs_cap = fs.runs_cap == 0 ? 8 : 2 * fs.runs_cap;
+        fs.runs = realloc(fs.runs, fs.runs_cap * sizeof(*fs.runs));
+    }
+    fs.runs[fs.n_runs++] = f;
+    fs.n = 0;
+    fs.arena_used = 0;
+}
+
+// Add a name to the listing
+void _fs_add(const char *name) {
+    size_t len = strlen(name) + 1;
+    if (fs.arena_used + len > FS_RUN_BYTES) { _fs_spill(); }
+    if (fs.n == fs.cap) {
+        fs.cap = fs.cap == 0 ? 1024 : 2 * fs.cap;
+        fs.names = realloc(fs.names, fs.cap * sizeof(*fs.names));
+        fs.aux = realloc(fs.aux, fs.cap * sizeof(*fs.aux));
+        if (fs.names == NULL || fs.aux == NULL) { _fs_throw_error("out of memory."); }
+    }
+    char *copy = fs.arena + fs.arena_used;
+    memcpy(copy, name, len);
+    fs.arena_used += len;
+    fs.names[fs.n++] = copy;
+}
+
+void _fs_print(const char *name) {
+    output_write(name, strlen(name));
+    output_putc('\n');
+}
+
+// Merge the spilled runs into the output
+void _fs_merge() {
+    char **heads = calloc(fs.n_runs, sizeof(char *));
+    size_t *caps = calloc(fs.n_runs, sizeof(size_t));
+    for (size_t r = 0; r < fs.n_runs; r++) {
+        if (getdelim(&heads[r], &caps[r], '\0', fs.runs[r]) < 0) { free(heads[r]); heads[r] = NULL; }
+    }
+    for (;;) {
+        size_t min = fs.n_runs;
+        for (size_t r = 0; r < fs.n_runs; r++) {
+            if (heads[r] != NULL && (min == fs.n_runs || strcmp(heads[r], heads[min]) < 0)) { min = r; }
+        }
+        if (min == fs.n_runs) { break; }
+        _fs_print(heads[min]);
+        if (getdelim(&heads[min], &caps[min], '\0', fs.runs[min]) < 0) {
+            free(heads[min]);
+            heads[min] = NULL;
+        }
+    }
+    for (size_t r = 0; r < fs.n_runs; r++) { fclose(fs.runs[r]); }
+    fs.n_runs = 0;
+    free(heads);
+    free(caps);
+}
+
+// List a directory, sorted, without hidden entries. Return 0 or an errno.
+int fs_list(const char *dir) {
+    int fd = openat(_fs_cwd(), dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        int err = errno;
+        output_flush();     // keep ordering with stderr
+        perror("Unable to open directory");
+        return err;
+    }
+    if (fs.arena == NULL && (fs.arena = malloc(FS_RUN_BYTES)) == NULL) { _fs_throw_error("out of memory."); }
+    fs.n = 0;
+    fs.arena_used = 0;
+
+    for (;;) {
+        long got = syscall(SYS_getdents64, fd, fs.dents, sizeof(fs.dents));
+        if (got < 0 && errno == EINTR) { continue; }
+        if (got < 0) {
+            int err = errno;
+            close(fd);
+            output_flush();
+            perror("Unable to read directory");
+            for (size_t r = 0; r < fs.n_runs; r++) { fclose(fs.runs[r]); }
+            fs.n_runs = 0;
+            return err;
+        }
+        if (got == 0) { break; }
+        for (long off = 0; off < got; ) {
+            struct LinuxDirent64 *d = (struct LinuxDirent64 *) (fs.dents + off);
+            off += d->d_reclen;
+            if (d->d_name[0] != '.') { _fs_add(d->d_name); }   // hidden entries are not listed
+        }
+    }
+    close(fd);
+
+    if (fs.n_runs == 0) {
+        _fs_radix_sort(fs.names, fs.aux, fs.n, 0);
+        for (size_t i = 0; i < fs.n; i++) { _fs_print(fs.names[i]); }
+    } else {
+        _fs_spill();
+        _fs_merge();
+    }
+    fs.n = 0;
+    fs.arena_used = 0;
+    return 0;
+}
@@ -0,0 +1,21 @@
+/*
+ *  Filesystem builtins.
+ *  Directories are listed by streaming getdents64() records through one
+ *  reusable buffer. Names are packed into an arena and radix sorted; a listing
+ *  too large for the arena is sorted in runs spilled to temporary files and
+ *  merged. Files and directories are created with openat()/mkdirat() against a
+ *  cached descriptor of the working directory.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define FS_DENTS_BUFFER (64 * 1024)         // getdents64() buffer
+#define FS_RUN_BYTES (4 * 1024 * 1024)      // names sorted in memory before spilling a run
+#define FS_RADIX_CUTOFF 16                  // buckets smaller than this are insertion sorted
+
+int fs_list(const char *dir);
+int fs_touch(const char *name);
+int fs_mkdir(const char *name);
+int fs_chdir(const char *dir);
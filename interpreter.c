@@ -7,28 +7,40 @@
 #include <unistd.h>
 #include <utime.h>
 #include <time.h>
-#include <dirent.h>
 #include <string.h>
 
 #include "varstore.h"
 #include "shell.h"
 #include "scheduler.h"
+#include "codesource.h"
+#include "codestore.h"
+#include "checkpoint.h"
+#include "server.h"
+#include "ztier.h"
+#include "slab.h"
+#include "profile.h"
+#include "output.h"
+#include "events.h"
+#include "vtime.h"
+#include "fsops.h"
+#include "latency.h"
+#include "memgroup.h"
 
 #define MAX_ARGS_SIZE 7
 
 int badcommand(){
-    printf("Unknown Command\n");
+    output_printf("Unknown Command\n");
     return 1;
 }
 
 int badcommandMsg(char *error_msg){
-    printf("Bad command: %s\n", error_msg);
+    output_printf("Bad command: %s\n", error_msg);
     return 2;
 }
 
 // For run command only
 int badcommandFileDoesNotExist(){
-    printf("Bad command: File not found\n");
+    output_printf("Bad command: File not found\n");
     return 3;
 }
 
@@ -39,16 +51,23 @@ int print(char* var);
 int echo(char* str);
 int run(char* script);
 int exec(char* scripts[], size_t n_scripts, enum Policy policy);
-int my_ls(const char* dirname);
+int events(char *args[], int n_args);
+int stats();
+int fork_cmd(char *n);
+int checkpoint(char *pid, char *file);
+int restore(char *file);
+int latency_cmd(char *arg);
+int memgroup_cmd(char *args[], int n_args);
 int badcommandFileDoesNotExist();
 
 // Interpret commands and their arguments
-int interpreter(char* command_args[], int args_size) {
+int _interpreter_dispatch(char* command_args[], int args_size) {
     int i;
 
     if (args_size < 1) {
         return badcommand();
-    } else if (args_size > MAX_ARGS_SIZE) {
+    } else if (args_size > MAX_ARGS_SIZE && strcmp(command_args[0], "my_touch") != 0 && strcmp(command_args[0], "my_mkdir") != 0) {
+        // (my_touch and my_mkdir take any number of names)
         return badcommandMsg("Too many tokens");
     }
 
@@ -108,43 +127,82 @@ int interpreter(char* command_args[], int args_size) {
         } else if (args_size == 2) {
             dir = command_args[1];
         }
-        return my_ls(dir);
+        return fs_list(dir);
     } else if (strcmp(command_args[0], "my_mkdir") == 0) {
         //my_mkdir
-        if (args_size != 2) {return badcommand();}
-        char* dir = command_args[1];
-        //check if it exists
-        if (dir[0] == '$') {
-            //already exist, check memory
-            char* dirname = mem_get_value(dir+1);
-            if (dirname == NULL) {return badcommandMsg("my_mkdir");}
-            dir = dirname;
+        if (args_size < 2) {return badcommand();}
+        int made = 0;
+        for (i = 1; i < args_size; i++) {
+            const char* dir = command_args[i];
+            //check if it exists
+            if (dir[0] == '$') {
+                //already exist, check memory
+                const char* dirname = mem_get_value(dir+1);
+                if (dirname == NULL) {return badcommandMsg("my_mkdir");}
+                dir = dirname;
+            }
+            if (strchr(dir, ' ') != NULL) {return badcommandMsg("my_mkdir");}
+            if (fs_mkdir(dir) != 0) { made = -1; }
         }
-        if (strchr(dir, ' ') != NULL) {return badcommandMsg("my_mkdir");}
-        return mkdir(dir, 0777);
+        return made;
     } else if (strcmp(command_args[0], "my_touch") == 0) {
 	    //my_touch
-	    for (int i = 1; i < args_size; i++) {
-            FILE *fp;
-            fp = fopen(command_args[i], "w");
-            fclose(fp);
+        int failed = 0;
+	    for (i = 1; i < args_size; i++) {
+            failed |= fs_touch(command_args[i]);
         }
-        return 0;
+        return failed ? badcommandMsg("my_touch") : 0;
     } else if (strcmp(command_args[0], "my_cd") == 0) {
         //my_cd
         if (args_size<2) {return badcommand();}
         char* dir = command_args[1];
         
-        if(chdir(dir) != 0){
+        if(fs_chdir(dir) != 0){
             return badcommandMsg("my_cd");
         } else {
             return 0;
         }
+    } else if (strcmp(command_args[0], "events") == 0) {
+        //events
+        if (args_size < 2 || args_size > 3) {return badcommand();}
+        return events(&command_args[1], args_size - 1);
+    } else if (strcmp(command_args[0], "fork") == 0) {
+        //fork
+        if (args_size > 2) {return badcommand();}
+        return fork_cmd(args_size == 2 ? command_args[1] : "1");
+    } else if (strcmp(command_args[0], "checkpoint") == 0) {
+        //checkpoint
+        if (args_size != 3) {return badcommand();}
+        return checkpoint(command_args[1], command_args[2]);
+    } else if (strcmp(command_args[0], "restore") == 0) {
+        //restore
+        if (args_size != 2) {return badcommand();}
+        return restore(command_args[1]);
+    } else if (strcmp(command_args[0], "stats") == 0) {
+        //stats
+        if (args_size != 1) {return badcommand();}
+        return stats();
+    } else if (strcmp(command_args[0], "latency") == 0) {
+        //latency
+        if (args_size > 2) {return badcommand();}
+        return latency_cmd(args_size == 2 ? command_args[1] : NULL);
+    } else if (strcmp(command_args[0], "memgroup") == 0) {
+        //memgroup
+        if (args_size != 1 && args_size != 3 && args_size != 4) {return badcommand();}
+        return memgroup_cmd(&command_args[1], args_size - 1);
     } else {
         return badcommand();
     }
 }
 
+// Interpret a command, timing it for the latency histograms
+int interpreter(char* command_args[], int args_size) {
+    uint64_t start = latency_now();
+    int result = _interpreter_dispatch(command_args, args_size);
+    if (args_size >= 1) { latency_record_command(command_args[0], latency_now() - start); }
+    return result;
+}
+
 int help() {
     // note the literal tab characters here for alignment
     char help_string[] = (
@@ -155,12 +213,13 @@ set VAR STRING         Assigns a value to shell memory\n \
 print VAR              Displays the STRING assigned to VAR\n \
 run SCRIPT.TXT         Executes the file SCRIPT.TXT\n "
 );
-    printf("%s\n", help_string);
+    output_printf("%s\n", help_string);
     return 0;
 }
 
 int quit() {
-    printf("Bye!\n");
+    output_printf("Bye!\n");
+    if (server_end_session()) { return 0; }  // serving: only the session ends
     exit(0);
 }
 
@@ -182,7 +241,7 @@ int set(char *var, char *value[], int value_length) {
 }
 
 int print(char *var) {
-    printf("%s\n", mem_get_value(var)); 
+    output_printf("%s\n", mem_get_value(var)); 
     return 0;
 }
 
@@ -191,32 +250,164 @@ int echo(char *str) {
         badcommand();
     }
     if(str[0] == '$') {
-        char *value = mem_get_value(str + 1);
+        const char *value = mem_get_value(str + 1);
         if (value == NULL) {
-            printf("Variable does not exist");
+            output_printf("Variable does not exist");
         } else {
-            printf("%s\n", mem_get_value(str+1));
+            output_printf("%s\n", value);
         }
     }
     else {
-        printf("%s\n", str);
+        output_printf("%s\n", str);
     }
     return 0;
 }
 
+// Paging event mode: quiet | verbose | drain | dump FILE
+int events(char *args[], int n_args) {
+    if (strcmp(args[0], "quiet") == 0 && n_args == 1) {
+        events_set_quiet(1);
+    } else if (strcmp(args[0], "verbose") == 0 && n_args == 1) {
+        events_set_quiet(0);
+    } else if (strcmp(args[0], "drain") == 0 && n_args == 1) {
+        events_drain();
+    } else if (strcmp(args[0], "dump") == 0 && n_args == 2) {
+        if (events_dump(args[1])) { return badcommandMsg("events dump"); }
+    } else {
+        return badcommand();
+    }
+    return 0;
+}
+
+// Print memory subsystem statistics
+int stats() {
+    output_printf("slab: %lu chunk allocations\n", slab_alloc_count());
+    codestore_print_stats();
+    ztier_print_stats();
+    mem_print_stats();
+    scheduler_print_stats();
+    vtime_print_stats();
+    return 0;
+}
+
+// Print the latency histograms, or clear them
+int latency_cmd(char *arg) {
+    if (arg == NULL) {
+        latency_print();
+    } else if (strcmp(arg, "reset") == 0) {
+        latency_reset();
+    } else {
+        return badcommand();
+    }
+    return 0;
+}
+
+// List memory groups, define one (NAME MIN MAX) or pick the group new
+// processes join (use NAME)
+int memgroup_cmd(char *args[], int n_args) {
+    if (n_args == 0) {
+        memgroup_print();
+        return 0;
+    } else if (n_args == 2 && strcmp(args[0], "use") == 0) {
+        int group = memgroup_find(args[1]);
+        if (group < 0) { return badcommandMsg("no such memory group"); }
+
+        // A running script moves itself, the shell picks the group for new processes
+        struct Scheduler *sch = get_running_scheduler();
+        struct pcb *p = sch == NULL ? NULL : get_running_pcb_by_pid(sch, getspid());
+        if (p != NULL) {
+            p->group = group;
+        } else {
+            memgroup_use(group);
+        }
+        return 0;
+    } else if (n_args == 3) {
+        char *end_min, *end_max;
+        long min = strtol(args[1], &end_min, 10);
+        long max = strtol(args[2], &end_max, 10);
+        if (*end_min != '\0' || *end_max != '\0' || min < 0 || min > N_FRAMES || max > N_FRAMES) {
+            return badcommandMsg("memgroup quotas");
+        }
+        switch (memgroup_define(args[0], min, max)) {
+            case 0: return 0;
+            case 1: return badcommandMsg("memgroup quotas");
+            default: return badcommandMsg("too many memory groups");
+        }
+    }
+    return badcommand();
+}
+
+// Fork the running script into n more processes
+int fork_cmd(char *n) {
+    char *end;
+    long children = strtol(n, &end, 10);
+    if (*end != '\0' || children < 1 || children > FORK_MAX) { return badcommandMsg("fork"); }
+    if (fork_process(children)) { return badcommandMsg("fork outside a script"); }
+    return 0;
+}
+
+// Save a running process (a PID, or "self") to an image file
+int checkpoint(char *pid, char *file) {
+    struct Scheduler *sch = get_running_scheduler();
+    spid_t target = strcmp(pid, "self") == 0 ? getspid() : strtoul(pid, NULL, 10);
+    struct pcb *p = sch == NULL || target == 0 ? NULL : get_running_pcb_by_pid(sch, target);
+    if (p == NULL) { return badcommandMsg("checkpoint: no such process"); }
+    switch (checkpoint_save(p, file)) {
+        case CHECKPOINT_OK:
+            return 0;
+        case CHECKPOINT_STREAMED:
+            return badcommandMsg("checkpoint: script was streamed");
+        default:
+            return badcommandMsg("checkpoint");
+    }
+}
+
+// Resume a process from an image file
+int restore(char *file) {
+    struct pcb *proc;
+    switch (checkpoint_restore(file, &proc)) {
+        case CHECKPOINT_OK:
+            break;
+        case CHECKPOINT_NO_SCRIPT:
+            return badcommandFileDoesNotExist();
+        case CHECKPOINT_SCRIPT_CHANGED:
+            return badcommandMsg("restore: script changed since checkpoint");
+        default:
+            return badcommandMsg("restore");
+    }
+
+    // Join the running scheduler, or run under the same policy as run
+    struct Scheduler *sch = get_running_scheduler();
+    if (sch == NULL) { sch = scheduler_get(RR30); }
+    scheduler_add(sch, proc);
+    if (!sch->running) {
+        scheduler_run(sch);
+    }
+
+    return 0;
+}
+
+// Open a script for run or exec. "-" streams the shell's standard input,
+// which sessions do not have; they may not stream FIFOs or devices either, as
+// the server does not wait on producers.
+struct CodeSource *_open_script(const char *script) {
+    if ((getspid() >> SESSION_SHIFT) != 0 && codesource_is_stream(script)) { return NULL; }
+    return codesource_open(script);
+}
+
 int run(char *script) {
     // Check memory limits
     if (N_FRAMES < 2) {
-        printf("Error: The shell memory is not large enough to support this command. Please rebuild with enough memory (need a minimum of two pages).\n");
+        output_printf("Error: The shell memory is not large enough to support this command. Please rebuild with enough memory (need a minimum of two pages).\n");
         return 1;
     }
 
-    FILE *p = fopen(script, "rt");
+    struct CodeSource *p = _open_script(script);
     if (p == NULL) { return badcommandFileDoesNotExist(); }
 
-    struct pcb *proc = new_process(p, script);  // create a new process
+    struct pcb *proc = new_process(p, N_FRAMES);  // create a new process, it may use the whole frame store
 
-    fclose(p);
+    codesource_release(p);
 
     // Initialize the scheduler
     struct Scheduler *sch = scheduler_get(RR30);
@@ -231,13 +422,35 @@ int run(char *script) {
 int exec(char *scripts[], size_t n_scripts, enum Policy policy) {
     // Check memory limits
     if (N_FRAMES < n_scripts * 2) {
-        printf("Error: The shell memory is not large enough to support this command. Please rebuild with enough memory (need a minimum of %zu pages), or rerun the command with fewer scripts.\n", 2 * n_scripts);
+        output_printf("Error: The shell memory is not large enough to support this command. Please rebuild with enough memory (need a minimum of %zu pages), or rerun the command with fewer scripts.\n", 2 * n_scripts);
         return 1;
     }
 
     // Initialize the scheduler
     struct Scheduler *sch = scheduler_get(policy);
 
+    // Open every script first, so a missing one leaves nothing half-started
+    struct CodeSource *sources[3] = {NULL};
+    for (int i = 0; i < n_scripts; i++) {
+        sources[i] = _open_script(scripts[i]);
+        if (sources[i] == NULL) {
+            for (int j = 0; j < i; j++) { codesource_release(sources[j]); }
+            return badcommandFileDoesNotExist();
+        }
+    }
+
+    // Split the frame store between distinct scripts by the pages their
+    // profiles want (two pages each for scripts without a profile)
+    int wanted[3] = {0};
+    int total_wanted = 0;
+    for (int i = 0; i < n_scripts; i++) {
+        int duplicate = 0;
+        for (int j = 0; j < i; j++) { duplicate |= strcmp(scripts[i], scripts[j]) == 0; }
+        if (duplicate) { continue; }
+        wanted[i] = profile_pages_wanted(sources[i]);
+        total_wanted += wanted[i];
+    }
+
     // Populate scheduler with jobs
     int processed_by_lookahead[3] = {0};      // keep track of which scripts have been processed (maximum of three)
     for (int i = 0; i < n_scripts; i++) {
@@ -246,29 +459,29 @@ int exec(char *scripts[], size_t n_scripts, enum Policy policy) {
             continue;
         }
 
-        FILE *p = fopen(scripts[i], "rt");
-        if (p == NULL) { return badcommandFileDoesNotExist(); }
+        struct CodeSource *p = sources[i];
+        int budget = wanted[i];
+        if (total_wanted > N_FRAMES) {
+            budget = wanted[i] * N_FRAMES / total_wanted;
+            if (budget < 1) { budget = 1; }
+        }
         
-        struct pcb *proc = new_process(p, scripts[i]);  // create a new process
+        struct pcb *proc = new_process(p, budget);  // create a new process
         scheduler_add(sch, proc);            // add the process to the scheduler
-    
-        fclose(p);
 
         // Look ahead for duplicates
         for (int j = i + 1; j < n_scripts; j++) {
             if (strcmp(scripts[i], scripts[j]) == 0) {
                 // script is mentioned again at index j, share memory
-                struct pcb *proc_cpy = pcb_new(
-                    generate_pid(),
-                    proc->page_tbl,
-                    scripts[i]
-                ); // new pid, same page table
+                struct pcb *proc_cpy = pcb_fork(proc, generate_pid());  // new pid, same page table
                 scheduler_add(sch, proc_cpy);
                 processed_by_lookahead[j] = 1;
             }
         }
     }
 
+    for (int i = 0; i < n_scripts; i++) { codesource_release(sources[i]); }
+
     // Run the scheduler (unless it's already running)
     if (!sch->running) {
         scheduler_run(sch);
@@ -276,32 +489,3 @@ int exec(char *scripts[], size_t n_scripts, enum Policy policy) {
 
     return 0;
 }
-
-// Comparing for sorting entries alphabetically
-int comparebyAlpha(const struct dirent **a, const struct dirent **b) {
-    return strcmp((*a)->d_name, (*b)->d_name);
-}
-
-//my_ls implementation
-int my_ls(const char* dir) {
-    struct dirent **namelist;
-    int n;
-
-    // Use scandir to read and sort directory entries
-    n = scandir(dir, &namelist, NULL, comparebyAlpha);
-    if (n < 0) {
-        perror("Unable to open directory");
-        return errno; // Return the error code
-    }
-
-    // Print sorted entries
-    for (int i = 0; i < n; i++) {
-        // Don't print hidden directories (beginning with .)
-        if (namelist[i]->d_name[0] != '.') {
-            printf("%s\n", namelist[i]->d_name);
-        }
-    }
-    free(namelist); // Free the array holding the entries
-
-    return 0; // Success
-}
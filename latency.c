@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+#include "output.h"
+
+// Commands with their own histogram, the last one takes all others
+const char *latency_commands[] = {
+    "help", "quit", "set", "echo", "print", "run", "exec", "my_ls", "my_mkdir", "my_touch", "my_cd",
+    "events", "fork", "checkpoint", "restore", "stats", "latency", "memgroup", "(other)",
+};
+#define LATENCY_N_COMMANDS (sizeof(latency_commands) / sizeof(latency_commands[0]))
+#define LATENCY_N (LATENCY_COMMAND + LATENCY_N_COMMANDS)
+
+const char *latency_names[LATENCY_COMMAND] = { "page fault", "evict", "ready wait" };
+
+struct {
+    struct LatencyHistogram histograms[LATENCY_N];
+} latency;
+
+// Monotonic time in nanoseconds
+uint64_t latency_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+// Bucket of a value
+unsigned int _latency_bucket(uint64_t v) {
+    if (v >= (uint64_t) 1 << LATENCY_MAX_BITS) { v = ((uint64_t) 1 << LATENCY_MAX_BITS) - 1; }
+    if (v < LATENCY_SUB) { return v; }
+    unsigned int shift = 63 - __builtin_clzll(v) - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB + (unsigned int) (v >> shift) - LATENCY_SUB;
+}
+
+// Highest value that falls in a bucket
+uint64_t _latency_bucket_top(unsigned int b) {
+    if (b < LATENCY_SUB) { return b; }
+    unsigned int shift = b / LATENCY_SUB - 1;
+    uint64_t top = b % LATENCY_SUB + LATENCY_SUB;
+    return ((top + 1) << shift) - 1;
+}
+
+void _latency_add(struct LatencyHistogram *h, uint64_t ns) {
+    h->buckets[_latency_bucket(ns)]++;
+    h->count++;
+    if (ns > h->max) { h->max = ns; }
+}
+
+void latency_record(enum LatencyKind kind, uint64_t ns) {
+    _latency_add(&latency.histograms[kind], ns);
+}
+
+void latency_record_command(const char *command, uint64_t ns) {
+    size_t i = 0;
+    while (i < LATENCY_N_COMMANDS - 1 && strcmp(latency_commands[i], command) != 0) { i++; }
+    _latency_add(&latency.histograms[LATENCY_COMMAND + i], ns);
+}
+
+// Value at quantile q (the top of the bucket holding it, at most the max)
+uint64_t _latency_quantile(struct LatencyHistogram *h, double q) {
+    uint64_t rank = (uint64_t) (q * h->count);
+    if (rank < q * h->count || rank == 0) { rank++; }   // ceiling, at least the first value
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t top = _latency_bucket_top(b);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+void latency_print() {
+    output_printf("%-20s %10s %10s %10s %10s %10s\n", "latency (us)", "count", "p50", "p99", "p999", "max");
+    for (size_t i = 0; i < LATENCY_N; i++) {
+        struct LatencyHistogram *h = &latency.histograms[i];
+        if (h->count == 0) { continue; }
+        char name[32];
+        if (i < LATENCY_COMMAND) {
+            snprintf(name, sizeof(name), "%s", latency_names[i]);
+        } else {
+            snprintf(name, sizeof(name), "cmd %s", latency_commands[i - LATENCY_COMMAND]);
+        }
+        output_printf("%-20s %10llu %10.1f %10.1f %10.1f %10.1f\n", name, (unsigned long long) h->count,
+            _latency_quantile(h, 0.5) / 1000.0, _latency_quantile(h, 0.99) / 1000.0,
+            _latency_quantile(h, 0.999) / 1000.0, h->max / 1000.0);
+    }
+}
+
+void latency_reset() {
+    memset(&latency, 0, sizeof(latency));
+}
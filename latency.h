@@ -0,0 +1,36 @@
+/*
+ *  Latency histograms.
+ *  Log-linear buckets in the style of HDR histograms: values below
+ *  LATENCY_SUB are exact, and above that each power of two is split into
+ *  LATENCY_SUB buckets, so a bucket is within 1/LATENCY_SUB of any value in
+ *  it. Recording is a few shifts and an increment; times come from
+ *  CLOCK_MONOTONIC in nanoseconds.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 40                 // values are capped at 2^40 ns (about 18 minutes)
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+
+enum LatencyKind {
+    LATENCY_PAGE_FAULT,             // fault service: loading the page and mapping it
+    LATENCY_EVICT,                  // choosing and evicting a victim frame
+    LATENCY_READY_WAIT,             // time a process waits in the ready queue between slices
+    LATENCY_COMMAND,                // by command, first of LATENCY_N_COMMANDS
+};
+
+struct LatencyHistogram {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+};
+
+uint64_t latency_now();
+void latency_record(enum LatencyKind kind, uint64_t ns);
+void latency_record_command(const char *command, uint64_t ns);
+void latency_print();
+void latency_reset();
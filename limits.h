@@ -10,6 +10,12 @@
 #define MEM_SIZE 1000
 #endif
 
+#ifdef ZTIERSIZE
+#define ZTIER_BYTES ZTIERSIZE
+#else
+#define ZTIER_BYTES (64 * 1024)
+#endif
+
 #define MAX_USER_INPUT 1000
 #define CMD_MAX_CHARS 100
 #define SCRIPT_MAX_LINES 150
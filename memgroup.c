@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memgroup.h"
+#include "limits.h"
+#include "scheduler.h"
+#include "server.h"
+#include "output.h"
+
+struct {
+    struct MemGroup groups[MEMGROUP_MAX];
+    int n;
+    unsigned char current[SERVER_SESSIONS_MAX + 1];     // group new processes join, by session
+} memgroup = {
+    .groups = { { .name = "default", .min = 0, .max = N_FRAMES } },
+    .n = 1,
+};
+
+// Group with a name, -1 if there is none
+int memgroup_find(const char *name) {
+    for (int i = 0; i < memgroup.n; i++) {
+        if (strcmp(memgroup.groups[i].name, name) == 0) { return i; }
+    }
+    return -1;
+}
+
+// Create a group or change its quotas. Return 0 on success, 1 if the quotas
+// are invalid, 2 if there are too many groups.
+int memgroup_define(const char *name, int min, int max) {
+    if (min < 0 || max < 1 || min > max || max > N_FRAMES || strlen(name) >= MEMGROUP_NAME_MAX) { return 1; }
+    int i = memgroup_find(name);
+    if (i < 0 && memgroup.n == MEMGROUP_MAX) { return 2; }
+
+    // The protected minimums must leave a frame unprotected: with the store
+    // full, some group then holds more than its minimum and can give one up
+    int reserved = min;
+    for (int j = 0; j < memgroup.n; j++) {
+        if (j != i) { reserved += memgroup.groups[j].min; }
+    }
+    if (reserved >= N_FRAMES) { return 1; }
+
+    if (i < 0) {
+        i = memgroup.n++;
+        memgroup.groups[i] = (struct MemGroup) { 0 };
+        strcpy(memgroup.groups[i].name, name);
+    }
+    memgroup.groups[i].min = min;
+    memgroup.groups[i].max = max;
+    return 0;
+}
+
+// Put new processes of the current session in a group
+void memgroup_use(int group) {
+    memgroup.current[getspid() >> SESSION_SHIFT] = group;
+}
+
+// Group new processes of the current session join
+int memgroup_current() {
+    return memgroup.current[getspid() >> SESSION_SHIFT];
+}
+
+// A session ended: its successor starts in the default group
+void memgroup_end_session(unsigned int session) {
+    memgroup.current[session] = 0;
+}
+
+// The group must replace its own pages to load another
+int memgroup_at_max(int group) {
+    return memgroup.groups[group].used >= memgroup.groups[group].max;
+}
+
+// May a frame charged to `victim` be taken to load a page for `group`?
+int memgroup_may_evict(int victim, int group) {
+    if (victim == group) { return 1; }
+    if (memgroup_at_max(group)) { return 0; }
+    return memgroup.groups[victim].used > memgroup.groups[victim].min;
+}
+
+// A frame was loaded for a group
+void memgroup_charge(int group) {
+    memgroup.groups[group].used++;
+    memgroup.groups[group].loads++;
+}
+
+// A frame charged to a group was evicted (or cleared)
+void memgroup_uncharge(int group, int evicted) {
+    memgroup.groups[group].used--;
+    if (evicted) { memgroup.groups[group].evictions++; }
+}
+
+void memgroup_print() {
+    output_printf("%-20s %6s %6s %6s %10s %10s\n", "group", "min", "max", "used", "loads", "evictions");
+    for (int i = 0; i < memgroup.n; i++) {
+        struct MemGroup *g = &memgroup.groups[i];
+        output_printf("%-20s %6d %6d %6d %10llu %10llu%s\n", g->name, g->min, g->max, g->used,
+            (unsigned long long) g->loads, (unsigned long long) g->evictions, i == memgroup_current() ? " *" : "");
+    }
+}
@@ -0,0 +1,43 @@
+/*
+ *  Memory groups.
+ *  Every process belongs to a group, and every loaded frame is charged to the
+ *  group of the process that loaded it. A group may hold at most `max` frames:
+ *  once there, it replaces its own least recently used pages (local
+ *  replacement) even if frames are free. A group holding `min` frames or fewer
+ *  is protected, and other groups do not evict its pages; the minimums add up
+ *  to less than the frame store, so a load always finds a frame it may take.
+ *  Group 0 ("default",
+ *  no minimum, the whole frame store) exists from the start.
+ *
+ *  New processes join the group chosen with `memgroup use`, kept per session;
+ *  forks stay in their parent's group. A script running `memgroup use` moves
+ *  itself, and its further pages are charged to the new group. Quotas apply
+ *  to this shell's frame store, not to a store shared with --shared-frames.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define MEMGROUP_MAX 16
+#define MEMGROUP_NAME_MAX 32
+
+struct MemGroup {
+    char name[MEMGROUP_NAME_MAX];
+    int min;                        // frames protected from other groups
+    int max;                        // frames the group may hold
+    int used;                       // frames charged to it
+    uint64_t loads;                 // pages loaded for it
+    uint64_t evictions;             // of its frames, by any group
+};
+
+int memgroup_define(const char *name, int min, int max);
+int memgroup_find(const char *name);
+void memgroup_use(int group);
+int memgroup_current();
+void memgroup_end_session(unsigned int session);
+int memgroup_at_max(int group);
+int memgroup_may_evict(int victim, int group);
+void memgroup_charge(int group);
+void memgroup_uncharge(int group, int evicted);
+void memgroup_print();
@@ -0,0 +1,164 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.h"
+
+struct {
+    int fd;
+    enum OutputPolicy policy;
+    size_t flush_at;                // pending bytes that trigger a flush
+    size_t len;                     // bytes pending in buf
+    char buf[OUTPUT_BUFFER_SIZE];
+    int (*queued)(int fd);          // 1 if earlier output to fd is still queued
+    void (*queue)(int fd, const char *data, size_t len);  // takes output fd cannot take now
+} output = {
+    .fd = STDOUT_FILENO,
+    .policy = OUTPUT_FLUSH_LINE,
+    .flush_at = OUTPUT_DEFAULT_FLUSH_KB * 1024,
+};
+
+// Hand the vectors to the queue
+void _output_queue_all(struct iovec *iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) { output.queue(output.fd, iov[i].iov_base, iov[i].iov_len); }
+}
+
+// Write every byte of the given vectors, retrying on short writes. Where the
+// descriptor is non-blocking and full, or already has output queued, the rest
+// is queued. Output errors are dropped, as they were with stdio.
+void _output_writev_all(struct iovec *iov, int iovcnt) {
+    if (output.queue != NULL && output.queued(output.fd)) {
+        _output_queue_all(iov, iovcnt);
+        return;
+    }
+    while (iovcnt > 0) {
+        ssize_t n = writev(output.fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && output.queue != NULL) { _output_queue_all(iov, iovcnt); }
+            return;
+        }
+        // Skip over what was written
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Flush the buffer together with an extra payload in one system call
+void _output_flush_with(const char *data, size_t len) {
+    struct iovec iov[2];
+    int iovcnt = 0;
+    if (output.len > 0) { iov[iovcnt++] = (struct iovec) { output.buf, output.len }; }
+    if (len > 0) { iov[iovcnt++] = (struct iovec) { (void *) data, len }; }
+    _output_writev_all(iov, iovcnt);
+    output.len = 0;
+}
+
+// Apply the flushing policy after new output was added
+void _output_maybe_flush(int wrote_newline) {
+    if (output.policy == OUTPUT_FLUSH_LINE && wrote_newline) {
+        output_flush();
+    } else if (output.policy == OUTPUT_FLUSH_SIZE && output.len >= output.flush_at) {
+        output_flush();
+    }
+}
+
+// Configure the output layer. flush_kb of 0 keeps the default threshold.
+void output_init(int fd, enum OutputPolicy policy, size_t flush_kb) {
+    output_flush();
+    output.fd = fd;
+    output.policy = policy;
+    if (flush_kb > 0) {
+        output.flush_at = flush_kb * 1024 < OUTPUT_BUFFER_SIZE ? flush_kb * 1024 : OUTPUT_BUFFER_SIZE;
+    }
+}
+
+// Send further output to another descriptor (-1 discards it)
+void output_set_fd(int fd) {
+    output_flush();
+    output.fd = fd;
+}
+
+// Queue output that a non-blocking descriptor cannot take yet, instead of
+// waiting for it (NULLs write directly again)
+void output_set_queue(int (*queued)(int fd), void (*queue)(int fd, const char *data, size_t len)) {
+    output_flush();
+    output.queued = queued;
+    output.queue = queue;
+}
+
+// Parse a policy name. Return 0 on success, 1 if the name is unknown.
+int output_parse_policy(const char *name, enum OutputPolicy *policy) {
+    if (strcmp(name, "line") == 0) { *policy = OUTPUT_FLUSH_LINE; }
+    else if (strcmp(name, "size") == 0) { *policy = OUTPUT_FLUSH_SIZE; }
+    else if (strcmp(name, "slice") == 0) { *policy = OUTPUT_FLUSH_SLICE; }
+    else { return 1; }
+    return 0;
+}
+
+void output_write(const char *data, size_t len) {
+    int wrote_newline = memchr(data, '\n', len) != NULL;
+    int overflow = output.len + len > OUTPUT_BUFFER_SIZE;
+    int flush_due = overflow
+        || (output.policy == OUTPUT_FLUSH_LINE && wrote_newline)
+        || (output.policy == OUTPUT_FLUSH_SIZE && output.len + len >= output.flush_at);
+
+    if (flush_due && (overflow || len >= OUTPUT_WRITEV_MIN)) {
+        // Coalesce the pending buffer and the payload without copying
+        _output_flush_with(data, len);
+        return;
+    }
+    memcpy(output.buf + output.len, data, len);
+    output.len += len;
+    _output_maybe_flush(wrote_newline);
+}
+
+void output_putc(char c) {
+    if (output.len == OUTPUT_BUFFER_SIZE) { output_flush(); }
+    output.buf[output.len++] = c;
+    _output_maybe_flush(c == '\n');
+}
+
+int output_printf(const char *fmt, ...) {
+    char small[1024];
+    va_list args;
+
+    va_start(args, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, args);
+    va_end(args);
+    if (n < 0) { return n; }
+
+    if ((size_t) n < sizeof(small)) {
+        output_write(small, n);
+    } else {
+        // Too long for the stack buffer
+        char *big = malloc(n + 1);
+        if (big == NULL) { return -1; }
+        va_start(args, fmt);
+        vsnprintf(big, n + 1, fmt, args);
+        va_end(args);
+        output_write(big, n);
+        free(big);
+    }
+    return n;
+}
+
+// A scheduler time slice ended
+void output_slice_end() {
+    if (output.policy == OUTPUT_FLUSH_SLICE) { output_flush(); }
+}
+
+void output_flush() {
+    if (output.len > 0) { _output_flush_with(NULL, 0); }
+}
@@ -0,0 +1,28 @@
+/*
+ *  Buffered output layer. All shell output goes through here so that it can be
+ *  batched into few large writes without changing the order it appears in.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define OUTPUT_DEFAULT_FLUSH_KB 16      // batch mode flush threshold
+#define OUTPUT_WRITEV_MIN 512           // payloads this large skip the buffer copy
+
+enum OutputPolicy {
+    OUTPUT_FLUSH_LINE,      // flush after every newline (interactive)
+    OUTPUT_FLUSH_SIZE,      // flush once flush_kb KB are pending (batch)
+    OUTPUT_FLUSH_SLICE,     // flush at scheduler slice boundaries, or when full
+};
+
+void output_init(int fd, enum OutputPolicy policy, size_t flush_kb);
+void output_set_fd(int fd);
+void output_set_queue(int (*queued)(int fd), void (*queue)(int fd, const char *data, size_t len));
+int output_parse_policy(const char *name, enum OutputPolicy *policy);
+void output_write(const char *data, size_t len);
+void output_putc(char c);
+int output_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void output_slice_end();
+void output_flush();
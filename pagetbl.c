@@ -3,42 +3,98 @@
 #include <string.h>
 
 #include "pagetbl.h"
+#include "slab.h"
+#include "output.h"
+#include "codestore.h"
+
+struct Slab page_tbl_slab = SLAB_INIT(page_tbl_t, 32);
 
 void _pagetbl_throw_error(const char *msg) {
-    printf("pagetbl: Runtime error: %s\n", msg);
+    output_printf("pagetbl: Runtime error: %s\n", msg);
     exit(99);
 }
 
+// A record maps its frame only while the frame still holds what was loaded
+// when it was set (evicting or clearing a frame bumps its generation). No
+// loaded frame has generation 0.
+int _pagetbl_is_current(struct PageTableRecord *r) {
+    return r->valid && r->gen != 0 && r->gen == frame_generation(r->frame);
+}
+
+// Drop a record's hold on its frame
+void _pagetbl_unmap(struct PageTableRecord *r) {
+    if (_pagetbl_is_current(r)) { frame_unref(r->frame); }
+    r->valid = 0;
+}
+
+// Next generation of a frame. Generations skip 0, which records treat as
+// never current.
+unsigned int page_tbl_next_gen(unsigned int gen) {
+    return gen + 1 == 0 ? 1 : gen + 1;
+}
+
 page_tbl_t *page_tbl_new() {
-    page_tbl_t *new = (page_tbl_t *) malloc(sizeof(page_tbl_t));
+    page_tbl_t *new = slab_alloc(&page_tbl_slab);
+    new->refs = 1;
     for (int i = 0; i < PAGE_TBL_SIZE; i++) {
-        (*new)[i].frame = UNKNOWN_FRAME;
-        (*new)[i].valid = 0;
+        new->records[i].frame = UNKNOWN_FRAME;
+        new->records[i].valid = 0;
+        new->records[i].gen = 0;
     }
     return new; 
 }
 
-// Look up a value in the page table. Return -1 if invalid.
+// Take another reference to a page table
+page_tbl_t *page_tbl_share(page_tbl_t *t) {
+    t->refs++;
+    return t;
+}
+
+// Look up a value in the page table. The record is invalid if the page is not
+// mapped or its frame has since been reused.
 struct PageTableRecord page_tbl_lookup(page_tbl_t *t, page_num_t n) {
     if (n < PAGE_TBL_SIZE) {
-        return (*t)[n];
+        struct PageTableRecord r = t->records[n];
+        r.valid = _pagetbl_is_current(&r);
+        return r;
     } else {
         _pagetbl_throw_error("page table index out of bounds.");
     }
 }
 
-// Set a value in the page table
+// Set a value in the page table. Code pages are read-only, so a shared table
+// is updated in place: the mapping is the same for every process using it.
 void page_tbl_set(page_tbl_t *t, page_num_t n, frame_num_t m) {
-    (*t)[n].frame = m;
-    (*t)[n].valid = 1;
+    struct PageTableRecord *r = &t->records[n];
+    _pagetbl_unmap(r);
+    r->frame = m;
+    r->valid = 1;
+    r->gen = frame_generation(m);
+    frame_ref(m);
+}
+
+// Find the page validly mapped to a frame. Return -1 if there is none.
+page_num_t page_tbl_find_frame(page_tbl_t *t, frame_num_t frame) {
+    for (int i = 0; i < PAGE_TBL_SIZE; i++) {
+        if (_pagetbl_is_current(&t->records[i]) && t->records[i].frame == frame) { return i; }
+    }
+    return -1;
 }
 
 void page_tbl_invalidate_frame(page_tbl_t *t, frame_num_t frame) {
     for (int i = 0; i < PAGE_TBL_SIZE; i++) {
-        if ((*t)[i].frame == frame) { (*t)[i].valid = 0; }
+        if (t->records[i].frame == frame) { _pagetbl_unmap(&t->records[i]); }
     }
 }
 
-void page_tbl_free(page_tbl_t *t) {
-    free(t);
+// Drop a reference to a page table, freeing it with the last one
+void page_tbl_release(page_tbl_t *t) {
+    if (--t->refs > 0) { return; }
+    for (int i = 0; i < PAGE_TBL_SIZE; i++) { _pagetbl_unmap(&t->records[i]); }
+    slab_free(&page_tbl_slab, t);
+}
+
+// Release every page table at once
+void page_tbl_pool_release() {
+    slab_release(&page_tbl_slab);
 }
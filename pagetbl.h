@@ -7,14 +7,25 @@
 struct PageTableRecord {
     int valid;
     frame_num_t frame;
+    unsigned int gen;           // generation of the frame when the page was mapped
 };
-typedef struct PageTableRecord page_tbl_t[PAGE_TBL_SIZE];
 
-#define UNKNOWN_FRAME -1;
+// Page tables are reference counted so that processes running the same code
+// (exec duplicates, forks) share one.
+typedef struct PageTable {
+    unsigned int refs;
+    struct PageTableRecord records[PAGE_TBL_SIZE];
+} page_tbl_t;
 
+#define UNKNOWN_FRAME -1
+
+unsigned int page_tbl_next_gen(unsigned int gen);
 page_tbl_t *page_tbl_new();
+page_tbl_t *page_tbl_share(page_tbl_t *t);
 struct PageTableRecord page_tbl_lookup(page_tbl_t *t, page_num_t n);
 void page_tbl_set(page_tbl_t *t, page_num_t n, frame_num_t m);
 size_t page_tbl_len(page_tbl_t *t);
+page_num_t page_tbl_find_frame(page_tbl_t *t, frame_num_t frame);
 void page_tbl_invalidate_frame(page_tbl_t *t, frame_num_t frame);
-void page_tbl_free(page_tbl_t *t);
+void page_tbl_release(page_tbl_t *t);
+void page_tbl_pool_release();
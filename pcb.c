@@ -2,24 +2,54 @@
 
 #include "pcb.h"
 #include "pagetbl.h"
+#include "slab.h"
+#include "output.h"
+#include "latency.h"
+#include "memgroup.h"
+
+struct Slab pcb_slab = SLAB_INIT(struct pcb, 64);
 
 // PCB constructor
-struct pcb *pcb_new(spid_t pid, page_tbl_t *pt, char *code_file) {
-    struct pcb *new = malloc(sizeof(struct pcb));
+struct pcb *pcb_new(spid_t pid, page_tbl_t *pt, struct CodeSource *src) {
+    struct pcb *new = slab_alloc(&pcb_slab);
     *new = (struct pcb) {
         .pid = pid,
         .page_tbl = pt,
         .pc = 0,
         .executing = 0,
         .job_length_score = 0, 
-        .code_file = strdup(code_file),
+        .src = src,
+        .started_at = vtime_now(),
+        .group = memgroup_current(),
+        .queued_at = latency_now(),
     };
+    strcpy(new->code_file, src->path);
+    codesource_ref(src);
+    return new;
+}
+
+// Copy a PCB under a new PID. The child shares the parent's page table and
+// starts at the parent's PC.
+struct pcb *pcb_fork(struct pcb *parent, spid_t pid) {
+    struct pcb *new = slab_alloc(&pcb_slab);
+    *new = *parent;
+    new->pid = pid;
+    new->executing = 0;
+    new->started_at = vtime_now();
+    new->queued_at = latency_now();
+    page_tbl_share(new->page_tbl);
+    codesource_ref(new->src);
     return new;
 }
 
 // PCB destructor
 void pcb_free(struct pcb *p) {
-    page_tbl_free(p->page_tbl);
-    free(p->code_file);
-    free(p);
+    page_tbl_release(p->page_tbl);
+    codesource_release(p->src);
+    slab_free(&pcb_slab, p);
 };
+
+// Release every PCB at once
+void pcb_pool_release() {
+    slab_release(&pcb_slab);
+}
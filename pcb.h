@@ -6,17 +6,41 @@
 
 #include "utiltypes.h"
 #include "pagetbl.h"
+#include "codesource.h"
+#include "profile.h"
+#include "workingset.h"
+#include "vtime.h"
+#include "perfctr.h"
 #include "shell.h"
 
+// An active repeat block
+struct LoopFrame {
+    uint32_t start;                 // first line of the body
+    uint32_t remaining;             // iterations left, including the current one
+};
+
 struct pcb {
     spid_t pid;
     page_tbl_t *page_tbl;
     unsigned int pc;                // program counter
     int executing;
     unsigned int job_length_score;  // used by AGING
-    char *code_file;
+    char code_file[CMD_MAX_CHARS];
+    struct CodeSource *src;         // where pages are faulted in from
+    struct ProfileRun profile;      // what this run touched, for the script's profile
+    struct WorkingSet ws;           // recent references and faults, for admission control
+    vtime_t started_at;             // virtual time the process was created
+    vtime_t ready_at;               // virtual time its outstanding page-ins complete
+    int stream_wait;                // waiting for more of its streamed script
+    int group;                      // memory group (see memgroup.h)
+    uint64_t queued_at;             // monotonic ns it last joined the ready queue or ended a slice
+    struct PerfCounts perf;         // hardware counters over its slices (--perf)
+    struct LoopFrame loops[CODESOURCE_LOOP_DEPTH];  // innermost last
+    int n_loops;
 };
 
-struct pcb *pcb_new(spid_t pid, page_tbl_t *pt, char *code_file);
+struct pcb *pcb_new(spid_t pid, page_tbl_t *pt, struct CodeSource *src);
+struct pcb *pcb_fork(struct pcb *parent, spid_t pid);
 size_t pcb_n_lines(struct pcb *p);
 void pcb_free(struct pcb *p);
+void pcb_pool_release();
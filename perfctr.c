@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+const char *perf_counter_names[PERF_N] = { "cycles", "instructions", "LLC misses", "branch misses" };
+
+const uint64_t perf_configs[PERF_N] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+struct {
+    int fds[PERF_N];                // -1 if not open
+    int slot[PERF_N];               // position in a group reading, -1 if not open
+    int n;                          // counters in the group
+    int leader;                     // fd of the group leader, -1 if none is open
+    uint64_t time_enabled;          // of the last reading
+    uint64_t time_running;
+} perf = {
+    .fds = { -1, -1, -1, -1 },
+    .slot = { -1, -1, -1, -1 },
+    .leader = -1,
+};
+
+// Group reading: PERF_FORMAT_GROUP with both times
+struct PerfGroupReading {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[PERF_N];
+};
+
+int _perf_event_open(uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd == -1;     // the group starts when the leader is enabled
+    attr.exclude_kernel = 1;            // allowed at perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Open and start the counters. Return the number opened; missing ones are
+// reported on stderr.
+int perf_open() {
+    for (int c = 0; c < PERF_N; c++) {
+        int fd = _perf_event_open(perf_configs[c], perf.leader);
+        if (fd < 0) {
+            fprintf(stderr, "perf: %s unavailable (%s)\n", perf_counter_names[c], strerror(errno));
+            continue;
+        }
+        if (perf.leader < 0) { perf.leader = fd; }
+        perf.fds[c] = fd;
+        perf.slot[c] = perf.n++;
+    }
+    if (perf.leader < 0) { return 0; }
+    if (ioctl(perf.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) != 0
+        || ioctl(perf.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0) {
+        fprintf(stderr, "perf: could not start the counters (%s)\n", strerror(errno));
+        perf_close();
+        return 0;
+    }
+    return perf.n;
+}
+
+int perf_active() {
+    return perf.leader >= 0;
+}
+
+int perf_available(enum PerfCounter c) {
+    return perf.slot[c] >= 0;
+}
+
+// Current counts (zero for counters that are not open)
+void perf_read(struct PerfCounts *now) {
+    memset(now, 0, sizeof(*now));
+    if (perf.leader < 0) { return; }
+    struct PerfGroupReading r;
+    if (read(perf.leader, &r, sizeof(r)) < (ssize_t) (3 * sizeof(uint64_t))) { return; }
+    perf.time_enabled = r.time_enabled;
+    perf.time_running = r.time_running;
+    for (int c = 0; c < PERF_N; c++) {
+        if (perf.slot[c] >= 0 && (uint64_t) perf.slot[c] < r.nr) { now->v[c] = r.values[perf.slot[c]]; }
+    }
+}
+
+// Add the counts between two readings
+void perf_accumulate(struct PerfCounts *acc, const struct PerfCounts *before, const struct PerfCounts *after) {
+    for (int c = 0; c < PERF_N; c++) { acc->v[c] += after->v[c] - before->v[c]; }
+}
+
+// Share of the time the group was counting rather than multiplexed out, as
+// of the last reading
+double perf_running_fraction() {
+    return perf.time_enabled == 0 ? 1.0 : (double) perf.time_running / perf.time_enabled;
+}
+
+void perf_close() {
+    for (int c = 0; c < PERF_N; c++) {
+        if (perf.fds[c] >= 0) { close(perf.fds[c]); }
+        perf.fds[c] = -1;
+        perf.slot[c] = -1;
+    }
+    perf.n = 0;
+    perf.leader = -1;
+}
@@ -0,0 +1,34 @@
+/*
+ *  Hardware performance counters.
+ *  Cycles, instructions, last-level cache misses and branch misses of this
+ *  process (user space only), opened as one perf_event_open() group so they
+ *  count over the same intervals and are read with a single read(). Counters
+ *  the kernel or the machine does not offer are left out; with none at all,
+ *  perf_open() fails and readings are zero.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_N,
+};
+
+struct PerfCounts {
+    uint64_t v[PERF_N];
+};
+
+extern const char *perf_counter_names[PERF_N];
+
+int perf_open();
+int perf_active();
+int perf_available(enum PerfCounter c);
+void perf_read(struct PerfCounts *now);
+void perf_accumulate(struct PerfCounts *acc, const struct PerfCounts *before, const struct PerfCounts *after);
+double perf_running_fraction();
+void perf_close();
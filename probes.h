@@ -0,0 +1,35 @@
+/*
+ *  Static tracepoints (USDT) for bpftrace, perf and SystemTap.
+ *  With <sys/sdt.h> each probe compiles to a single nop plus an ELF note
+ *  naming it and its argument locations; a tracer patches the nop only while
+ *  attached. Without the header (or with -D MYSH_NO_PROBES) the macros expand
+ *  to nothing. Arguments must be integers or pointers.
+ *
+ *  Probes (provider "mysh"):
+ *    page_load(pid, page, frame, policy)       load_page() filled a frame
+ *    evict(pid, page, frame, policy)           a frame was evicted; pid owned the page
+ *    page_fault(pid, page, frame, policy)      a fault was serviced
+ *    slice_start(pid, page, pc, policy)        a process is scheduled
+ *    slice_end(pid, page, pc, policy)          it gives up the CPU
+ *    process_exit(pid, page, instructions, policy)
+ *    var_get(pid, name, value)                 value is NULL when unset
+ *    var_set(pid, name, value)
+ *  Policy is an enum Policy, 0 when no scheduler is running.
+ */
+
+#pragma once
+
+#if !defined(MYSH_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MYSH_PROBES 1
+#endif
+#endif
+
+#ifdef MYSH_PROBES
+#define MYSH_PROBE3(name, a, b, c) DTRACE_PROBE3(mysh, name, a, b, c)
+#define MYSH_PROBE4(name, a, b, c, d) DTRACE_PROBE4(mysh, name, a, b, c, d)
+#else
+#define MYSH_PROBE3(name, a, b, c) do { } while (0)
+#define MYSH_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "codestore.h"
+
+struct {
+    char *path;                     // NULL while profiling is off
+    uint64_t clock;
+    int n;
+    struct ScriptProfile entries[PROFILE_MAX];
+} profiles;
+
+// Load the profile file (a missing file is an empty profile). Return 0 on success.
+int profile_open(const char *path) {
+    profiles.path = strdup(path);
+    profiles.n = 0;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) { return 0; }
+
+    char magic[sizeof(PROFILE_MAGIC) - 1];
+    uint32_t record_size, n;
+    int ok = fread(magic, sizeof(magic), 1, f) == 1
+        && memcmp(magic, PROFILE_MAGIC, sizeof(magic)) == 0
+        && fread(&record_size, sizeof(record_size), 1, f) == 1
+        && record_size == sizeof(struct ScriptProfile)
+        && fread(&n, sizeof(n), 1, f) == 1
+        && n <= PROFILE_MAX
+        && fread(profiles.entries, sizeof(struct ScriptProfile), n, f) == n;
+    fclose(f);
+
+    if (!ok) { return 1; }  // ignore a profile from another build
+    profiles.n = n;
+    for (int i = 0; i < profiles.n; i++) {
+        if (profiles.entries[i].last_used > profiles.clock) { profiles.clock = profiles.entries[i].last_used; }
+    }
+    return 0;
+}
+
+int profile_enabled() {
+    return profiles.path != NULL;
+}
+
+// Write the profiles back, replacing the file atomically (atexit hook)
+void profile_save() {
+    if (!profile_enabled()) { return; }
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", profiles.path);
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL) { return; }
+
+    uint32_t record_size = sizeof(struct ScriptProfile), n = profiles.n;
+    int ok = fwrite(PROFILE_MAGIC, sizeof(PROFILE_MAGIC) - 1, 1, f) == 1
+        && fwrite(&record_size, sizeof(record_size), 1, f) == 1
+        && fwrite(&n, sizeof(n), 1, f) == 1
+        && fwrite(profiles.entries, sizeof(struct ScriptProfile), n, f) == n;
+    if (fclose(f) != 0 || !ok || rename(tmp, profiles.path) != 0) {
+        fprintf(stderr, "profile: could not write '%s'\n", profiles.path);
+        remove(tmp);
+    }
+}
+
+int _profile_matches(struct ScriptProfile *p, struct CodeSource *src) {
+    return p->dev == (uint64_t) src->dev && p->ino == (uint64_t) src->ino && p->size == src->size
+        && p->mtime_sec == src->mtime.tv_sec && p->mtime_nsec == src->mtime.tv_nsec;
+}
+
+// Profile of a script, NULL if it has none
+struct ScriptProfile *_profile_find(struct CodeSource *src) {
+    if (!profile_enabled()) { return NULL; }
+    for (int i = 0; i < profiles.n; i++) {
+        if (_profile_matches(&profiles.entries[i], src)) { return &profiles.entries[i]; }
+    }
+    return NULL;
+}
+
+// Number of pages a script wants resident (its working set when profiled)
+int profile_pages_wanted(struct CodeSource *src) {
+    struct ScriptProfile *p = _profile_find(src);
+    int pages = p != NULL ? p->last.n_touched : INITIAL_PAGE_N;
+    int n_pages = codesource_n_pages(src);
+    return pages < n_pages ? pages : n_pages;
+}
+
+// Pages to load when a script starts, at most max. Profiled scripts get the
+// pages their last run touched, in the order it touched them; others get the
+// first INITIAL_PAGE_N pages.
+int profile_preload_order(struct CodeSource *src, page_num_t *pages, int max) {
+    struct ScriptProfile *p = _profile_find(src);
+    int n_pages = codesource_n_pages(src);
+    int n = 0;
+    if (p != NULL) {
+        for (int i = 0; i < p->last.n_touched && n < max; i++) {
+            if (p->last.touch_order[i] < n_pages) { pages[n++] = p->last.touch_order[i]; }
+        }
+    } else {
+        for (; n < INITIAL_PAGE_N && n < n_pages && n < max; n++) { pages[n] = n; }
+    }
+    return n;
+}
+
+void profile_run_touch(struct ProfileRun *run, page_num_t page) {
+    if (page < 0 || page >= PAGE_TBL_SIZE || run->touched[page]) { return; }
+    run->touched[page] = 1;
+    run->touch_order[run->n_touched++] = page;
+}
+
+void profile_run_fault(struct ProfileRun *run, page_num_t page) {
+    if (run->n_faults < PROFILE_FAULTS_MAX) { run->faults[run->n_faults++] = page; }
+}
+
+// Store the run of a finished process as its script's profile
+void profile_record(struct CodeSource *src, struct ProfileRun *run) {
+    if (!profile_enabled() || src->streamed) { return; }     // a streamed script never runs again
+
+    struct ScriptProfile *p = _profile_find(src);
+    if (p == NULL) {
+        if (profiles.n < PROFILE_MAX) {
+            p = &profiles.entries[profiles.n++];
+        } else {
+            // Replace the least recently run script
+            p = &profiles.entries[0];
+            for (int i = 1; i < profiles.n; i++) {
+                if (profiles.entries[i].last_used < p->last_used) { p = &profiles.entries[i]; }
+            }
+        }
+        *p = (struct ScriptProfile) {
+            .dev = src->dev, .ino = src->ino, .size = src->size,
+            .mtime_sec = src->mtime.tv_sec, .mtime_nsec = src->mtime.tv_nsec,
+        };
+    }
+    p->runs++;
+    p->last_used = ++profiles.clock;
+    p->last = *run;
+}
@@ -0,0 +1,49 @@
+/*
+ *  Per-script execution profiles.
+ *  When enabled, each finished process records which pages it touched (in
+ *  first-touch order), its page faults and how many instructions it ran.
+ *  Profiles persist in a file, keyed by the identity of the script file, and
+ *  decide which pages a later run of the same script preloads.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "utiltypes.h"
+#include "codesource.h"
+
+#define PROFILE_MAGIC "MYSHPRF1"
+#define PROFILE_MAX 256             // scripts remembered, least recently run dropped first
+#define PROFILE_FAULTS_MAX 32       // faults kept per run
+
+// What one run of a script did
+struct ProfileRun {
+    uint32_t instructions;
+    uint16_t n_touched;
+    uint16_t n_faults;
+    int16_t touch_order[PAGE_TBL_SIZE];     // pages in first-touch order
+    int16_t faults[PROFILE_FAULTS_MAX];     // faulted pages, in order
+    uint8_t touched[PAGE_TBL_SIZE];
+};
+
+// Persistent record for one script file
+struct ScriptProfile {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t last_used;             // profile clock, for replacement
+    uint32_t runs;
+    struct ProfileRun last;
+};
+
+int profile_open(const char *path);
+int profile_enabled();
+void profile_save();
+int profile_pages_wanted(struct CodeSource *src);
+int profile_preload_order(struct CodeSource *src, page_num_t *pages, int max);
+void profile_run_touch(struct ProfileRun *run, page_num_t page);
+void profile_run_fault(struct ProfileRun *run, page_num_t page);
+void profile_record(struct CodeSource *src, struct ProfileRun *run);
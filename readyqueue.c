@@ -1,26 +1,76 @@
 #include "readyqueue.h"
+#include "slab.h"
+#include "output.h"
 
 // TODO better separation of input validation and business logic
 
+struct Slab readyqueue_slab = SLAB_INIT(struct ReadyQueueElement, READYQUEUE_POOL_CHUNK);
+
 // Print an error and exit (fail fast)
 void _readyqueue_throw_error(const char *msg) {
-    printf("readyqueue: Runtime error: %s\n", msg);
+    output_printf("readyqueue: Runtime error: %s\n", msg);
     exit(99);
 }
 
-// ReadyQueueElement constructor
-struct ReadyQueueElement *_readyqueue_new_element(struct pcb *val, struct ReadyQueueElement *next) {
-    struct ReadyQueueElement *new = (struct ReadyQueueElement *) malloc(sizeof(struct ReadyQueueElement));
-    new->val = val;
-    new->next = next;
+// Bucket of the PID index for a pid
+size_t _readyqueue_bucket(spid_t pid) {
+    return (pid * 2654435761u) & (READYQUEUE_INDEX_SIZE - 1);
+}
+
+// Take an element from the pool
+struct ReadyQueueElement *_readyqueue_new_element(struct pcb *val) {
+    struct ReadyQueueElement *new = slab_alloc(&readyqueue_slab);
+    *new = (struct ReadyQueueElement) { .val = val };
     return new;
 }
 
+// Return an element to the pool
+void _readyqueue_free_element(struct ReadyQueueElement *e) {
+    slab_free(&readyqueue_slab, e);
+}
+
+// Add an element to the PID index
+void _readyqueue_index_add(ReadyQueue *q, struct ReadyQueueElement *e) {
+    size_t b = _readyqueue_bucket(e->val->pid);
+    e->next_in_bucket = q->index[b];
+    q->index[b] = e;
+}
+
+// Find the element holding a PID, NULL if absent
+struct ReadyQueueElement *_readyqueue_index_find(ReadyQueue *q, spid_t pid) {
+    struct ReadyQueueElement *cursor = q->index[_readyqueue_bucket(pid)];
+    while (cursor != NULL && cursor->val->pid != pid) { cursor = cursor->next_in_bucket; }
+    return cursor;
+}
+
+// Drop an element from the PID index
+void _readyqueue_index_remove(ReadyQueue *q, struct ReadyQueueElement *e) {
+    struct ReadyQueueElement **link = &q->index[_readyqueue_bucket(e->val->pid)];
+    while (*link != NULL && *link != e) { link = &(*link)->next_in_bucket; }
+    if (*link == NULL) { _readyqueue_throw_error("PID index out of sync with queue."); }
+    *link = e->next_in_bucket;
+}
+
+// Link e into the list after predecessor (at the front if predecessor is NULL)
+void _readyqueue_link_after(ReadyQueue *q, struct ReadyQueueElement *predecessor, struct ReadyQueueElement *e) {
+    e->prev = predecessor;
+    e->next = predecessor == NULL ? q->head : predecessor->next;
+    if (e->next != NULL) { e->next->prev = e; } else { q->tail = e; }
+    if (predecessor != NULL) { predecessor->next = e; } else { q->head = e; }
+    _readyqueue_index_add(q, e);
+}
+
+// Unlink e from the list and the index, and return it to the pool
+void _readyqueue_unlink(ReadyQueue *q, struct ReadyQueueElement *e) {
+    _readyqueue_index_remove(q, e);
+    if (e->prev != NULL) { e->prev->next = e->next; } else { q->head = e->next; }
+    if (e->next != NULL) { e->next->prev = e->prev; } else { q->tail = e->prev; }
+    _readyqueue_free_element(e);
+}
+
 // ReadyQueue constructor
 ReadyQueue *readyqueue_new() {
-    ReadyQueue *new = (ReadyQueue *) malloc(sizeof(ReadyQueue));
-    new->head = NULL;
-    new->tail = NULL;
+    ReadyQueue *new = (ReadyQueue *) calloc(1, sizeof(ReadyQueue));
     return new;
 }
 
@@ -44,10 +94,14 @@ struct pcb *readyqueue_get(ReadyQueue *q, int i) {
     return out->val;
 }
 
-ReadyQueue_iterator_t *readyqueue_iterator(ReadyQueue *q) {
-    ReadyQueue_iterator_t *new = (ReadyQueue_iterator_t *) malloc(sizeof(ReadyQueue_iterator_t));
-    new->next = q->head;
-    return new;
+// Get the queued process with a given PID, NULL if it is not queued.
+struct pcb *readyqueue_find(ReadyQueue *q, spid_t pid) {
+    struct ReadyQueueElement *e = _readyqueue_index_find(q, pid);
+    return e == NULL ? NULL : e->val;
+}
+
+ReadyQueue_iterator_t readyqueue_iterator(ReadyQueue *q) {
+    return (ReadyQueue_iterator_t) { .next = q->head };
 }
 
 // Return 1 if there is another item present, otherwise 0.
@@ -66,68 +120,34 @@ struct pcb *readyqueue_iterator_next(ReadyQueue_iterator_t *iter) {
     }
 }
 
-void readyqueue_iterator_free(ReadyQueue_iterator_t *iter) {
-    free(iter);
-}
-
 // Insert an element after index i. Insert at the beginning of the list if i < 0.
 void readyqueue_insertafter(ReadyQueue *q, int i, struct pcb *p) {
-    if (i < 0) {
-        // Insert at the front of the list
-        q->head = _readyqueue_new_element(p, q->head);
-        if (q->head->next == NULL) { q->tail = q->head; }
-        return;
-    }
-
-    // Find the predecessor
-    struct ReadyQueueElement *predecessor = _readyqueue_get_element(q, i);
-
-    // Error checking
-    if (predecessor == NULL) {
-        _readyqueue_throw_error("attempted to insert after index out of bounds.");
+    struct ReadyQueueElement *predecessor = NULL;
+    if (i >= 0) {
+        // Find the predecessor
+        predecessor = _readyqueue_get_element(q, i);
+
+        // Error checking
+        if (predecessor == NULL) {
+            _readyqueue_throw_error("attempted to insert after index out of bounds.");
+        }
     }
-
-    // Allocate a new element
-    struct ReadyQueueElement *new = _readyqueue_new_element(p, predecessor->next);
-
-    // Insert 
-    predecessor->next = new;
-    if (predecessor == q->tail) { q->tail = new; }
+    _readyqueue_link_after(q, predecessor, _readyqueue_new_element(p));
 }
 
 void readyqueue_append(ReadyQueue *q, struct pcb *p) {
-    struct ReadyQueueElement *new = _readyqueue_new_element(p, NULL);
-    if (readyqueue_isempty(q)) {
-        q->head = new;
-        q->tail = q->head;
-    }
-    else { q->tail->next = new; }  // when head is NULL, tail is also NULL
-    q->tail = new;
+    _readyqueue_link_after(q, q->tail, _readyqueue_new_element(p));
 }
 
 void readyqueue_delete(ReadyQueue *q, int i) {
-    struct ReadyQueueElement *to_delete;
-
     // Error checking
     if (readyqueue_isempty(q)) {
         _readyqueue_throw_error("attempted to delete from empty queue.");
     }
 
-    if (i == 0) {
-        to_delete = q->head;
-        q->head = to_delete->next;
-        if (q->head == NULL || q->head->next == NULL) { q->tail = q->head; }
-    } else {
-        struct ReadyQueueElement *predecessor = _readyqueue_get_element(q, i - 1);
-        if (predecessor == NULL) { _readyqueue_throw_error("attempted to delete index out of bounds."); }
-
-        to_delete = predecessor->next;
-        if (to_delete == NULL) { _readyqueue_throw_error("attempted to delete index out of bounds."); }
-        
-        predecessor->next = to_delete->next;
-        if (to_delete == q->tail) { q->tail = predecessor; }
-    }
-    free(to_delete);
+    struct ReadyQueueElement *to_delete = _readyqueue_get_element(q, i);
+    if (to_delete == NULL) { _readyqueue_throw_error("attempted to delete index out of bounds."); }
+    _readyqueue_unlink(q, to_delete);
 }
 
 // Remove element from the ready queue. Return 0 if successful, 1 otherwise.
@@ -137,33 +157,10 @@ int readyqueue_remove(ReadyQueue *q, struct pcb *p) {
         _readyqueue_throw_error("attempted to delete from empty queue.");
         return 1;
     }
-    
-    struct ReadyQueueElement *predecessor = q->head;
-    struct ReadyQueueElement *to_delete;
-
-    // element at head
-    if (q->head->val == p) {
-        to_delete = q->head;
-        q->head = to_delete->next;
-        if (q->head == NULL || q->head->next == NULL) { q->tail = q->head; }
-        free(to_delete);
-        return 0;
-    }
 
-    predecessor = q->head;
-    
-    // Move to the entry before the one to be removed
-    while (1) {
-        if (predecessor->next == NULL) { return 1; }
-        if (predecessor->next->val == p) { break; }
-        predecessor = predecessor->next;
-    }
-
-    // Delete the entry
-    to_delete = predecessor->next;
-    predecessor->next = to_delete->next;
-    if (to_delete == q->tail) { q->tail = predecessor; }
-    free(to_delete);
+    struct ReadyQueueElement *to_delete = _readyqueue_index_find(q, p->pid);
+    if (to_delete == NULL || to_delete->val != p) { return 1; }
+    _readyqueue_unlink(q, to_delete);
 
     return 0;
 }
@@ -173,17 +170,19 @@ int readyqueue_isempty(ReadyQueue *q) {
 }
 
 void readyqueue_free(ReadyQueue *q) {
-    if (!readyqueue_isempty(q)) {
-        // Free all elements
-        struct ReadyQueueElement *current = q->head;
+    // Return all elements to the pool
+    struct ReadyQueueElement *current = q->head;
+    while (current != NULL) {
         struct ReadyQueueElement *next = current->next;
-        while (current != NULL) {
-            free(current);
-            current = next;
-            next = current->next;
-        }
+        _readyqueue_free_element(current);
+        current = next;
     }
 
     // Free the list
     free(q);
 }
+
+// Release the element pool (all queues must be freed first)
+void readyqueue_pool_release() {
+    slab_release(&readyqueue_slab);
+}
@@ -1,37 +1,49 @@
 /*
  *  The ready queue of processes.
  *  (actually a list, because that seemed more practical)
+ *
+ *  Doubly-linked through pooled elements, with a PID index so that lookup and
+ *  removal of a process do not need to walk the list.
  */
 
 #pragma once
 
 #include "pcb.h"
 
+#define READYQUEUE_INDEX_SIZE 64    // buckets in the PID index (power of two)
+#define READYQUEUE_POOL_CHUNK 32    // elements allocated at once when the pool runs dry
+
 struct ReadyQueueElement {
     struct pcb *val;
+    struct ReadyQueueElement *prev;
     struct ReadyQueueElement *next;
+    struct ReadyQueueElement *next_in_bucket;   // PID index chain
 };
 
 typedef struct {
     struct ReadyQueueElement *head;
     struct ReadyQueueElement *tail;
+    struct ReadyQueueElement *index[READYQUEUE_INDEX_SIZE];
 } ReadyQueue;
 
+// Iterators live on the caller's stack. The current element may be removed
+// while iterating.
 typedef struct {
     struct ReadyQueueElement *next;
 } ReadyQueue_iterator_t;
 
 ReadyQueue *readyqueue_new();
 struct pcb *readyqueue_get(ReadyQueue *q, int i);
+struct pcb *readyqueue_find(ReadyQueue *q, spid_t pid);
 
-ReadyQueue_iterator_t *readyqueue_iterator(ReadyQueue *q);
+ReadyQueue_iterator_t readyqueue_iterator(ReadyQueue *q);
 int readyqueue_iterator_hasnext(ReadyQueue_iterator_t *iter);
 struct pcb *readyqueue_iterator_next(ReadyQueue_iterator_t *iter);
-void readyqueue_iterator_free(ReadyQueue_iterator_t *iter);
-    
+
 void readyqueue_insertafter(ReadyQueue *q, int i, struct pcb *p);
 void readyqueue_append(ReadyQueue *q, struct pcb *p);
 void readyqueue_delete(ReadyQueue *q, int i);
 int readyqueue_remove(ReadyQueue *q, struct pcb *p);
 int readyqueue_isempty(ReadyQueue *q);
 void readyqueue_free(ReadyQueue *q);
+void readyqueue_pool_release();
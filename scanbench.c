@@ -0,0 +1,154 @@
+/*
+ *  Microbenchmark for the scanning kernels in simdscan.c.
+ *  Builds a script-like buffer and reports bytes per cycle for every kernel
+ *  set the CPU supports, then, where hardware counters are available,
+ *  instructions per byte and branch misses per MB over all repetitions.
+ *  Delimiter search runs over the script buffer (shell-length tokens) and
+ *  over a buffer of long path tokens, to show where the vector versions pay.
+ *
+ *  make scanbench && ./scanbench [MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simdscan.h"
+#include "perfctr.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TICKS() __rdtsc()
+#define BENCH_UNIT "cycle"
+#else
+#define BENCH_TICKS() _bench_ns()
+#define BENCH_UNIT "ns"
+#endif
+
+#define BENCH_REPS 5
+#define BENCH_N_KERNELS 4
+
+unsigned long long _bench_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long long) t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Lines like a generated load script: tokens of 1-8 bytes
+const char *bench_script_lines[] = {
+    "echo hello\n", "set x some value here\n", "print x\n",
+    "my_mkdir $dirname\n", "echo $x; echo done\n", "exec a.txt b.txt RR\n",
+};
+
+// Lines whose tokens are long paths, 40-70 bytes each
+const char *bench_long_lines[] = {
+    "run /home/user/projects/simulated-os/scripts/generated/load_test_0001.txt\n",
+    "exec /var/tmp/mysh/batches/nightly/regression_suite_part_one.txt /var/tmp/mysh/batches/nightly/regression_suite_part_two.txt RR\n",
+    "set configuration_directory_for_the_current_session_and_its_children\n",
+};
+
+// Fill buf by repeating n lines
+void _bench_fill(char *buf, size_t len, const char *lines[], size_t n_lines) {
+    size_t i = 0, k = 0;
+    while (i < len) {
+        const char *l = lines[k++ % n_lines];
+        size_t n = strlen(l);
+        if (n > len - i) { n = len - i; }
+        memcpy(buf + i, l, n);
+        i += n;
+    }
+}
+
+// Best-of-N ticks for one kernel over the buffer; counters over all N go to *counts
+double _bench_run(int which, const char *buf, size_t len, size_t *offsets, struct PerfCounts *counts) {
+    unsigned long long best = ~0ull;
+    volatile size_t sink = 0;
+    struct PerfCounts before, after;
+    perf_read(&before);
+    for (int r = 0; r < BENCH_REPS; r++) {
+        unsigned long long t0 = BENCH_TICKS();
+        if (which == 0) {
+            sink += scan_count_byte(buf, len, '\n');
+        } else if (which == 1) {
+            sink += scan_newline_offsets(buf, len, 0, offsets);
+        } else {
+            // Walk every token the way parseInput does
+            const char *p = buf, *end = buf + len;
+            while (p < end) {
+                p = scan_kernels->find_delim_wide(p, end) + 1;
+                sink++;
+            }
+        }
+        unsigned long long t = BENCH_TICKS() - t0;
+        if (t < best) { best = t; }
+    }
+    perf_read(&after);
+    memset(counts, 0, sizeof(*counts));
+    perf_accumulate(counts, &before, &after);
+    return (double) len / (double) best;
+}
+
+// One table of a counter scaled per byte processed
+void _bench_print_counts(const char *title, enum PerfCounter c, double scale, const char *impls[], const char *kernels[],
+        struct PerfCounts counts[BENCH_N_KERNELS][3], int ran[BENCH_N_KERNELS][3]) {
+    if (!perf_available(c)) { return; }
+    printf("\n%-16s %10s %10s %10s\n", title, impls[0], impls[1], impls[2]);
+    for (int k = 0; k < BENCH_N_KERNELS; k++) {
+        printf("%-16s", kernels[k]);
+        for (int i = 0; i < 3; i++) {
+            if (ran[k][i]) {
+                printf(" %10.3f", counts[k][i].v[c] * scale);
+            } else {
+                printf(" %10s", "n/a");
+            }
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+    size_t len = mb * 1024 * 1024;
+    char *buf = malloc(len);
+    char *long_buf = malloc(len);
+    size_t *offsets = malloc((len + 1) * sizeof(size_t));
+    if (buf == NULL || long_buf == NULL || offsets == NULL) {
+        fprintf(stderr, "scanbench: out of memory\n");
+        return 1;
+    }
+    _bench_fill(buf, len, bench_script_lines, sizeof(bench_script_lines) / sizeof(bench_script_lines[0]));
+    _bench_fill(long_buf, len, bench_long_lines, sizeof(bench_long_lines) / sizeof(bench_long_lines[0]));
+
+    const char *impls[] = { "scalar", "sse2", "avx2" };
+    const char *kernels[] = { "count newlines", "line offsets", "delims (script)", "delims (long)" };
+    struct PerfCounts counts[BENCH_N_KERNELS][3];
+    int ran[BENCH_N_KERNELS][3] = { { 0 } };
+    int perf = perf_open() > 0;
+    printf("%zu MB buffer, best of %d, bytes/%s (auto-selected: %s)\n", mb, BENCH_REPS, BENCH_UNIT, scan_impl_name());
+    printf("%-16s %10s %10s %10s\n", "kernel", impls[0], impls[1], impls[2]);
+    for (int k = 0; k < BENCH_N_KERNELS; k++) {
+        printf("%-16s", kernels[k]);
+        for (int i = 0; i < 3; i++) {
+            if (scan_use(impls[i])) {
+                printf(" %10s", "n/a");
+            } else {
+                const char *in = k == 3 ? long_buf : buf;
+                printf(" %10.2f", _bench_run(k < 2 ? k : 2, in, len, offsets, &counts[k][i]));
+                ran[k][i] = 1;
+            }
+        }
+        printf("\n");
+    }
+    if (perf) {
+        double bytes = (double) len * BENCH_REPS;
+        _bench_print_counts("instructions/byte", PERF_INSTRUCTIONS, 1.0 / bytes, impls, kernels, counts, ran);
+        _bench_print_counts("branch misses/MB", PERF_BRANCH_MISSES, 1024.0 * 1024.0 / bytes, impls, kernels, counts, ran);
+        perf_close();
+    }
+
+    free(offsets);
+    free(long_buf);
+    free(buf);
+    return 0;
+}
@@ -1,24 +1,68 @@
-#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "scheduler.h"
 #include "shell.h"
 #include "codestore.h"
 #include "pagetbl.h"
 #include "pcb.h"
+#include "output.h"
+#include "events.h"
+#include "profile.h"
+#include "workingset.h"
+#include "varstore.h"
+#include "vtime.h"
+#include "latency.h"
+#include "probes.h"
+#include "memgroup.h"
+#include "perfctr.h"
 
 struct Scheduler *running_scheduler;
 
 int current_pid = 0;
 int last_pid = 0;
+spid_t session_base = 0;        // PID of the shell in the current session
+
+// Serving sessions: jobs stay queued and the server drives the schedulers
+int detached = 0;
+void (*switch_hook)(spid_t pid) = NULL;     // called before a process runs
+
+// Hardware counters by policy, and for the last processes to finish (--perf)
+struct PerfProcess {
+    spid_t pid;
+    enum Policy policy;
+    char script[32];
+    uint64_t lines;
+    struct PerfCounts counts;
+};
+
+struct {
+    int requested;
+    struct PerfCounts by_policy[POLICIES];
+    uint64_t lines[POLICIES];
+    struct PerfProcess done[SCHEDULER_PERF_PROCESSES];   // ring
+    unsigned long n_done;
+} perf_attr;
+
+const char *policy_names[] = { "-", "RR", "RR30" };
+
+// Page fault frequency admission control
+struct {
+    int enabled;
+    unsigned long thrash_detections;    // rounds where working sets overcommitted the frame store
+    unsigned long suspensions;
+    unsigned long resumes;
+} admission;
 
 // Get simulated PID
 spid_t getspid() {
     return current_pid;
 }
 
-int generate_pid() {
-    return ++last_pid;
+// Make a session current: its top-level variables and new PIDs
+void scheduler_set_session(unsigned int session) {
+    session_base = session << SESSION_SHIFT;
+    current_pid = session_base;
 }
 
 struct Scheduler *get_running_scheduler() {
@@ -31,27 +75,15 @@ struct Scheduler *get_running_scheduler() {
 
 // Get PCB by PID. Return NULL if the PCB is not running. NOT THREAD-SAFE.
 struct pcb *get_running_pcb_by_pid(struct Scheduler *sch, spid_t pid) {
-    struct pcb *out = NULL;
-
-    // Iterate over the ready queue
-    ReadyQueue_iterator_t *iter = readyqueue_iterator(sch->ready_queue);
-    struct pcb *cursor;
-    while (readyqueue_iterator_hasnext(iter)) {
-        cursor = readyqueue_iterator_next(iter);
-        if (cursor->pid == pid) {
-            out = cursor;
-            break;
-        }
-    }
-    readyqueue_iterator_free(iter); 
-
-    return out;
+    struct pcb *p = readyqueue_find(sch->ready_queue, pid);
+    return p != NULL ? p : readyqueue_find(sch->suspended, pid);
 }
 
 struct Scheduler *scheduler_new(enum Policy policy) {
     struct Scheduler *new = (struct Scheduler *) malloc(sizeof(struct Scheduler));
     new->policy = policy;
     new->ready_queue = readyqueue_new();
+    new->suspended = readyqueue_new();
     new->running = 0;
     return new;
 }
@@ -75,11 +107,28 @@ struct Scheduler *scheduler_get(enum Policy policy) {
     return flyweight_store[i].scheduler;
 }
 
-void scheduler_add(struct Scheduler *sch, struct pcb *job) {
-    int insert_after_i;
-    struct pcb *cursor;
-    ReadyQueue_iterator_t *iter;
+// 1 if a process with the PID is queued in any scheduler
+int _scheduler_pid_live(spid_t pid) {
+    for (int i = 0; i < POLICIES && flyweight_store[i].policy != 0; i++) {
+        if (get_running_pcb_by_pid(flyweight_store[i].scheduler, pid) != NULL) { return 1; }
+    }
+    return 0;
+}
+
+// New PIDs belong to the session of the caller (a process or the shell).
+// Once the counter wraps, they skip 0 (the session's own variables) and
+// PIDs still in use.
+int generate_pid() {
+    spid_t session = current_pid & ~SESSION_PID_MASK;
+    for (unsigned int tries = 0; tries < SESSION_PID_MASK; tries++) {
+        spid_t pid = session | (++last_pid & SESSION_PID_MASK);
+        if ((pid & SESSION_PID_MASK) != 0 && !_scheduler_pid_live(pid)) { return pid; }
+    }
+    output_printf("scheduler: Runtime error: no free PIDs.\n");
+    exit(99);
+}
 
+void scheduler_add(struct Scheduler *sch, struct pcb *job) {
     switch (sch->policy) {
         case RR:
         case RR30:
@@ -90,50 +139,210 @@ void scheduler_add(struct Scheduler *sch, struct pcb *job) {
 
 // Remove a job
 void scheduler_remove(struct Scheduler *sch, struct pcb *job) {
+    MYSH_PROBE4(process_exit, job->pid, job->pc / PAGE_SIZE, job->profile.instructions, sch->policy);
     readyqueue_remove(sch->ready_queue, job);  // remove from ready queue
     pcb_free(job);                               // deallocate (also frees shell memory)
 }
 
+// Charge the counters of a slice to its process and policy
+void _scheduler_perf_slice(struct Scheduler *sch, struct pcb *proc, struct PerfCounts *before, uint32_t lines_before) {
+    struct PerfCounts after;
+    perf_read(&after);
+    perf_accumulate(&proc->perf, before, &after);
+    perf_accumulate(&perf_attr.by_policy[sch->policy], before, &after);
+    perf_attr.lines[sch->policy] += proc->profile.instructions - lines_before;
+}
+
+// Keep a finished process's counters for stats
+void _scheduler_perf_done(struct Scheduler *sch, struct pcb *proc) {
+    struct PerfProcess *p = &perf_attr.done[perf_attr.n_done++ % SCHEDULER_PERF_PROCESSES];
+    const char *base = strrchr(proc->code_file, '/');
+    p->pid = proc->pid;
+    p->policy = sch->policy;
+    snprintf(p->script, sizeof(p->script), "%.*s", (int) sizeof(p->script) - 1, base == NULL ? proc->code_file : base + 1);
+    p->lines = proc->profile.instructions;
+    p->counts = proc->perf;
+}
+
 // Helper method to RR and RR30
 void _round_robin(struct Scheduler *sch, size_t delta) {
-    ReadyQueue_iterator_t *iter = readyqueue_iterator(sch->ready_queue);
+    ReadyQueue_iterator_t iter = readyqueue_iterator(sch->ready_queue);
     struct pcb *cursor;
     int done;               // 1 if the process finished, 0 otherwise
-    while (readyqueue_iterator_hasnext(iter)) {
-        cursor = readyqueue_iterator_next(iter);
+    int ran = 0;
+    vtime_t next_ready = 0; // earliest page-in completion of a waiting process
+    int streaming = 0;      // 1 if a process waits for its streamed script
+    while (readyqueue_iterator_hasnext(&iter)) {
+        cursor = readyqueue_iterator_next(&iter);
+
+        // In virtual time, a process waits for its page-ins
+        if (vtime_enabled() && cursor->ready_at > vtime_now()) {
+            if (next_ready == 0 || cursor->ready_at < next_ready) { next_ready = cursor->ready_at; }
+            continue;
+        }
+        // A streamed script's producer may not have written the lines yet
+        if (cursor->stream_wait) {
+            if (!codesource_stream_ready(cursor->src)) {
+                streaming = 1;
+                continue;
+            }
+            cursor->stream_wait = 0;
+        }
+        ran = 1;
+
+        latency_record(LATENCY_READY_WAIT, latency_now() - cursor->queued_at);
+        MYSH_PROBE4(slice_start, cursor->pid, cursor->pc / PAGE_SIZE, cursor->pc, sch->policy);
+        struct PerfCounts before;
+        uint32_t lines_before = cursor->profile.instructions;
+        if (perf_active()) { perf_read(&before); }
         done = run_lines_from_process(sch, cursor, delta);
+        if (perf_active()) { _scheduler_perf_slice(sch, cursor, &before, lines_before); }
+        MYSH_PROBE4(slice_end, cursor->pid, cursor->pc / PAGE_SIZE, cursor->pc, sch->policy);
+        cursor->queued_at = latency_now();
+        output_slice_end();
         if (done) {
             // Process finished
+            profile_record(cursor->src, &cursor->profile);
+            vtime_process_done(cursor->started_at);
+            if (perf_active()) { _scheduler_perf_done(sch, cursor); }
             scheduler_remove(sch, cursor); 
         }
     }
-    readyqueue_iterator_free(iter);
+
+    // Everyone is waiting on the disk, or on producers (a server never waits:
+    // sessions cannot stream)
+    if (!ran && next_ready != 0) {
+        vtime_idle_until(next_ready);
+    } else if (!ran && streaming && !detached) {
+        codesource_wait_streams();
+    }
+}
+
+// Move a process between the ready and suspended queues
+void _scheduler_move(ReadyQueue *from, ReadyQueue *to, struct pcb *p) {
+    readyqueue_remove(from, p);
+    readyqueue_append(to, p);
+}
+
+// Page fault frequency control, run between rounds. When the working sets of
+// the ready processes do not fit in the frame store and some process is
+// faulting heavily, suspend the largest until the rest fit; resume suspended
+// processes in order once their working set fits again.
+void _scheduler_balance(struct Scheduler *sch) {
+    int demand = 0, n_ready = 0, thrashing = 0;
+    struct pcb *largest = NULL;
+    int largest_ws = -1;
+    ReadyQueue_iterator_t iter = readyqueue_iterator(sch->ready_queue);
+    while (readyqueue_iterator_hasnext(&iter)) {
+        struct pcb *p = readyqueue_iterator_next(&iter);
+        int ws = ws_size(&p->ws);
+        demand += ws;
+        n_ready++;
+        if (ws_fault_frequency(&p->ws) >= PFF_HIGH) { thrashing = 1; }
+        if (ws > largest_ws) { largest = p; largest_ws = ws; }
+    }
+
+    if (thrashing && demand > N_FRAMES) {
+        admission.thrash_detections++;
+        if (admission.enabled && n_ready > 1) {
+            _scheduler_move(sch->ready_queue, sch->suspended, largest);
+            admission.suspensions++;
+        }
+        return;
+    }
+
+    while (!readyqueue_isempty(sch->suspended)) {
+        struct pcb *p = readyqueue_get(sch->suspended, 0);
+        int ws = ws_size(&p->ws);
+        if (!readyqueue_isempty(sch->ready_queue) && demand + ws > N_FRAMES) { break; }
+        _scheduler_move(sch->suspended, sch->ready_queue, p);
+        admission.resumes++;
+        demand += ws;
+    }
+}
+
+// One pass over the ready queue
+void _scheduler_round(struct Scheduler *sch) {
+    _scheduler_balance(sch);
+    switch (sch->policy) {
+        case RR:
+            _round_robin(sch, RR_DELTA);
+            break;
+        case RR30:
+            _round_robin(sch, RR30_DELTA);
+            break;
+    }
+}
+
+int _scheduler_has_jobs(struct Scheduler *sch) {
+    return !readyqueue_isempty(sch->ready_queue) || !readyqueue_isempty(sch->suspended);
 }
 
 // Main scheduler loop
 void scheduler_run(struct Scheduler *sch) {
+    // Detached: the jobs run from scheduler_poll()
+    if (detached) { return; }
+
     // Check that no other scheduler is running
     if (running_scheduler != NULL) {
-        printf("scheduler: Runtime error: attempted to run two schedulers at once.\n");
+        output_printf("scheduler: Runtime error: attempted to run two schedulers at once.\n");
         return;  // don't exit
     }
     sch->running = 1;
     running_scheduler = sch;
 
     // Run until no jobs remain
-    while (!readyqueue_isempty(sch->ready_queue)) {
-        switch (sch->policy) {
-            case RR:
-                _round_robin(sch, RR_DELTA);
-                break;
-            case RR30:
-                _round_robin(sch, RR30_DELTA);
-                break;
-        }
+    while (_scheduler_has_jobs(sch)) {
+        _scheduler_round(sch);
     }
 
     sch->running = 0;
     running_scheduler = NULL;
+    current_pid = session_base;  // back to the shell's own variables
+}
+
+// Leave jobs queued by scheduler_run() for scheduler_poll(), and call `hook`
+// whenever a process is about to run
+void scheduler_set_detached(int on, void (*hook)(spid_t pid)) {
+    detached = on;
+    switch_hook = hook;
+}
+
+// Run one round of every scheduler that has jobs
+void scheduler_poll() {
+    for (int i = 0; i < POLICIES && flyweight_store[i].scheduler != NULL; i++) {
+        struct Scheduler *sch = flyweight_store[i].scheduler;
+        if (!_scheduler_has_jobs(sch)) { continue; }
+        sch->running = 1;
+        running_scheduler = sch;
+        _scheduler_round(sch);
+        sch->running = 0;
+        running_scheduler = NULL;
+    }
+    current_pid = session_base;
+}
+
+// Return 1 if any scheduler has jobs for scheduler_poll()
+int scheduler_poll_pending() {
+    for (int i = 0; i < POLICIES && flyweight_store[i].scheduler != NULL; i++) {
+        if (_scheduler_has_jobs(flyweight_store[i].scheduler)) { return 1; }
+    }
+    return 0;
+}
+
+// Count the processes of a session, in every scheduler
+int scheduler_session_jobs(unsigned int session) {
+    int n = 0;
+    for (int i = 0; i < POLICIES && flyweight_store[i].scheduler != NULL; i++) {
+        ReadyQueue *queues[2] = { flyweight_store[i].scheduler->ready_queue, flyweight_store[i].scheduler->suspended };
+        for (int q = 0; q < 2; q++) {
+            ReadyQueue_iterator_t iter = readyqueue_iterator(queues[q]);
+            while (readyqueue_iterator_hasnext(&iter)) {
+                n += readyqueue_iterator_next(&iter)->pid >> SESSION_SHIFT == session;
+            }
+        }
+    }
+    return n;
 }
 
 // Free all schedulers
@@ -141,71 +350,192 @@ void scheduler_free() {
     for (int i = 0; i < POLICIES; i++)  {
         if (flyweight_store[i].scheduler != NULL) {
             readyqueue_free(flyweight_store[i].scheduler->ready_queue);
+            readyqueue_free(flyweight_store[i].scheduler->suspended);
             free(flyweight_store[i].scheduler);
         }
     }
+
+    // Release pooled objects in bulk
+    readyqueue_pool_release();
+    pcb_pool_release();
+    page_tbl_pool_release();
+}
+
+// Suspend processes when working sets overcommit the frame store (off by default)
+void scheduler_set_admission_control(int on) {
+    admission.enabled = on;
+}
+
+// Count cycles, instructions, cache and branch misses per policy and process
+// (--perf). Return 0 if at least one counter could be opened.
+int scheduler_set_perf() {
+    perf_attr.requested = 1;
+    return perf_open() == 0;
 }
 
-// Create a new process from a stream which produces code
-struct pcb *new_process(FILE *code, char *code_file) {
+// One row of counters: totals, then IPC and per-line rates
+void _scheduler_perf_row(const char *label, const struct PerfCounts *c, uint64_t lines) {
+    output_printf("  %-24s", label);
+    for (int i = 0; i < PERF_N; i++) {
+        if (perf_available(i)) {
+            output_printf(" %14llu", (unsigned long long) c->v[i]);
+        } else {
+            output_printf(" %14s", "n/a");
+        }
+    }
+    output_printf(" %10llu", (unsigned long long) lines);
+    if (perf_available(PERF_CYCLES) && perf_available(PERF_INSTRUCTIONS) && c->v[PERF_CYCLES] > 0) {
+        output_printf(" %6.2f", (double) c->v[PERF_INSTRUCTIONS] / c->v[PERF_CYCLES]);
+    } else {
+        output_printf(" %6s", "n/a");
+    }
+    if (perf_available(PERF_INSTRUCTIONS) && lines > 0) {
+        output_printf(" %12.1f\n", (double) c->v[PERF_INSTRUCTIONS] / lines);
+    } else {
+        output_printf(" %12s\n", "n/a");
+    }
+}
+
+void _scheduler_print_perf() {
+    if (!perf_attr.requested) {
+        output_printf("perf: off\n");
+        return;
+    }
+    if (!perf_active()) {
+        output_printf("perf: counters unavailable\n");
+        return;
+    }
+    double running = perf_running_fraction();
+    output_printf("perf: user-space counters during scheduler slices%s\n", running < 1.0 ? " (multiplexed, counts are partial)" : "");
+    output_printf("  %-24s", "");
+    for (int i = 0; i < PERF_N; i++) { output_printf(" %14s", perf_counter_names[i]); }
+    output_printf(" %10s %6s %12s\n", "lines", "IPC", "insns/line");
+    for (int p = RR; p <= RR30; p++) {
+        if (perf_attr.lines[p] == 0) { continue; }
+        char label[32];
+        snprintf(label, sizeof(label), "policy %s", policy_names[p]);
+        _scheduler_perf_row(label, &perf_attr.by_policy[p], perf_attr.lines[p]);
+    }
+    unsigned long first = perf_attr.n_done > SCHEDULER_PERF_PROCESSES ? perf_attr.n_done - SCHEDULER_PERF_PROCESSES : 0;
+    for (unsigned long i = first; i < perf_attr.n_done; i++) {
+        struct PerfProcess *proc = &perf_attr.done[i % SCHEDULER_PERF_PROCESSES];
+        char label[64];
+        snprintf(label, sizeof(label), "pid %d %s (%s)", proc->pid, proc->script, policy_names[proc->policy]);
+        _scheduler_perf_row(label, &proc->counts, proc->lines);
+    }
+}
+
+void scheduler_print_stats() {
+    output_printf("admission: %s, %lu thrash detections, %lu suspensions, %lu resumes\n",
+        admission.enabled ? "on" : "off", admission.thrash_detections,
+        admission.suspensions, admission.resumes);
+    _scheduler_print_perf();
+}
+
+// Create a new process from a script, preloading up to `budget` pages
+struct pcb *new_process(struct CodeSource *code, int budget) {
     // Generate PID
     spid_t pid = generate_pid();
 
-    // Create page table
-    page_tbl_t *pt = load_script(code, pid);
+    // Create page table (in virtual time, the process waits for its preloads)
+    vtime_io_begin();
+    page_tbl_t *pt = load_script(code, pid, memgroup_current(), budget);
 
-    // Create PCB
-    struct pcb *new = pcb_new(generate_pid(), pt, code_file);
+    // Create PCB (same PID as the frames were loaded under, so eviction can find it)
+    struct pcb *new = pcb_new(pid, pt, code);
+    new->ready_at = vtime_io_done();
     return new;
 }
 
+// Fork the running process n times. The children share its page table, get a
+// copy of its variables, and continue after the current line. Return 1 if no
+// process is running.
+int fork_process(int n) {
+    struct Scheduler *sch = get_running_scheduler();
+    struct pcb *parent = sch == NULL ? NULL : get_running_pcb_by_pid(sch, current_pid);
+    if (parent == NULL) { return 1; }
+
+    for (int i = 0; i < n; i++) {
+        struct pcb *child = pcb_fork(parent, generate_pid());
+        child->pc++;  // the parent is still executing the fork line
+        mem_fork(parent->pid, child->pid);
+        scheduler_add(sch, child);
+    }
+    return 0;
+}
+
 // Page fault system call to scheduler. Return 0 if the process should continue, 1 if it is finished.
 int scheduler_page_fault(struct Scheduler *sch, struct pcb *caller, page_num_t page) {
-    // Open the caller's code source file (backing store or otherwise)
-    FILE *codesource = fopen(caller->code_file, "r");
-    if (codesource == NULL) {
-        printf("scheduler: Runtime error: could not open code file '%s' to read.", caller->code_file);
-        exit(99);
-    }
-    
-    // Advance the buffer
-    for (int newlines = 0; newlines < page * PAGE_SIZE; ) {
-        char c = getc(codesource);
-        if (c == '\n') { newlines++; }
-        else if (c == EOF) { return 1; }  // Process finished
-    }
+    // Past the end of the script
+    if (!codesource_has_page(caller->src, page)) { return 1; }  // Process finished
 
     // Load the missing page
-    printf("Page fault! ");
-    frame_num_t new_frame = load_page(codesource, caller->pid);
+    int verbose = !events_quiet();
+    if (verbose) { output_printf("Page fault! "); }
+    uint64_t start = latency_now();
+    vtime_io_begin();
+    frame_num_t new_frame = load_page(caller->src, page, caller->pid, caller->group);
+    caller->ready_at = vtime_io_done();
     page_tbl_set(caller->page_tbl, page, new_frame);
-    putchar('\n');
-
-    fclose(codesource);
+    latency_record(LATENCY_PAGE_FAULT, latency_now() - start);
+    MYSH_PROBE4(page_fault, caller->pid, page, new_frame, sch->policy);
+    profile_run_fault(&caller->profile, page);
+    ws_fault(&caller->ws);
+    events_record(EVENT_PAGE_FAULT, caller->pid, page, new_frame);
+    if (verbose) { output_putc('\n'); }
 
     return 0;
 }
 
+// Take a repeat or end line: enter the body (or skip it when N is 0), or go
+// back to the start of the body while iterations remain
+void _scheduler_loop(struct pcb *proc, struct CodeLoop *loop) {
+    if ((unsigned int) loop->match > proc->pc) {
+        // repeat N
+        if (loop->count == 0 || proc->n_loops == CODESOURCE_LOOP_DEPTH) {
+            proc->pc = loop->match + 1;
+            return;
+        }
+        proc->loops[proc->n_loops++] = (struct LoopFrame) { .start = proc->pc + 1, .remaining = loop->count };
+        proc->pc++;
+    } else if (proc->n_loops > 0 && --proc->loops[proc->n_loops - 1].remaining > 0) {
+        // end, another iteration
+        proc->pc = proc->loops[proc->n_loops - 1].start;
+    } else {
+        // end, loop done
+        if (proc->n_loops > 0) { proc->n_loops--; }
+        proc->pc++;
+    }
+}
+
 // Run a specified number of lines from a process. Return 1 if the process finishes.
-// Set lines to -1 to run until termination (or page fault).
+// Set lines to -1 to run until termination (or page fault). Each repeat/end
+// line taken counts as a line, so loops use up the quantum like unrolled code.
 int run_lines_from_process(struct Scheduler *sch, struct pcb *proc, int lines) {
     current_pid = proc->pid;
     proc->executing = 1;
+    if (switch_hook != NULL) { switch_hook(proc->pid); }
 
-    char *line;                     // line to execute
+    struct LineSpan *line;          // line to execute
     frame_num_t frame_n;            // current frame number
     frame_t frame = NULL;           // current frame
-    int stop = lines < 0 ? INT_MAX : proc->pc + lines;
-    while (proc->pc < stop) {
-        if (frame == NULL || (proc->pc % PAGE_SIZE) == 0) {
+    page_num_t frame_page = -1;     // page held by the current frame
+    for (int ran = 0; lines < 0 || ran < lines; ran++) {
+        if (frame == NULL || proc->pc / PAGE_SIZE != (unsigned int) frame_page) {
             // Load a new frame
 
             // Lookup page table
             page_num_t page_n = proc->pc / PAGE_SIZE;
+            frame_page = page_n;
+            profile_run_touch(&proc->profile, page_n);
             struct PageTableRecord record = page_tbl_lookup(proc->page_tbl, page_n);
             if (record.valid) {
                 // Found valid record, get frame and continue
                 frame = get_frame(record.frame, proc->pid);
+            } else if (!codesource_page_ready(proc->src, page_n)) {
+                // Wait for the page to stream in, so it is loaded whole
+                proc->stream_wait = 1;
+                return 0;
             } else {
                 // Page fault
                 return scheduler_page_fault(sch, proc, page_n);
@@ -217,11 +547,25 @@ int run_lines_from_process(struct Scheduler *sch, struct pcb *proc, int lines) {
             }
         }
         line = frame_get_line(frame, proc->pc % PAGE_SIZE);
-        if (line[0] == '\0') { return 1; }  // reached end of file
-
-        // Run the command
-        execute_line(line);
-        proc->pc++;
+        if (line->text == NULL) { return 1; }  // reached end of file
+
+        // Run the command (loop lines were resolved when the script was indexed)
+        struct CodeLoop *loop = codesource_loop(proc->src, proc->pc);
+        page_num_t page_n = proc->pc / PAGE_SIZE;
+        if (loop != NULL && loop->match == CODESOURCE_LOOP_PENDING) {
+            // The end of the block has not streamed in yet
+            proc->stream_wait = 1;
+            return 0;
+        }
+        if (loop != NULL) {
+            _scheduler_loop(proc, loop);
+        } else {
+            execute_line(line->text, line->len);
+        }
+        vtime_instruction();
+        ws_reference(&proc->ws, page_n);
+        if (loop == NULL) { proc->pc++; }
+        proc->profile.instructions++;
     }
 
     return 0;
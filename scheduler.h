@@ -3,6 +3,10 @@
 #define RR_DELTA 2
 #define RR30_DELTA 30
 #define POLICIES 5
+#define FORK_MAX 64      // children per fork
+#define SESSION_SHIFT 20 // PIDs carry their session in the bits above this
+#define SESSION_PID_MASK ((1u << SESSION_SHIFT) - 1)
+#define SCHEDULER_PERF_PROCESSES 16     // finished processes whose counters stats shows
 
 #include "readyqueue.h"
 
@@ -15,6 +19,7 @@ enum Policy {
 struct Scheduler {
     enum Policy policy;
     ReadyQueue *ready_queue;
+    ReadyQueue *suspended;          // held back by admission control, resumed in FIFO order
     int running;
 };
 
@@ -27,6 +32,15 @@ void scheduler_add_to_front(struct Scheduler *sch, struct pcb *job);
 void scheduler_run(struct Scheduler *sch);
 void scheduler_run_multithreaded(struct Scheduler *sch);
 void scheduler_free();
-struct pcb *new_process(FILE *code, char *code_file);
+void scheduler_set_admission_control(int on);
+void scheduler_set_session(unsigned int session);
+void scheduler_set_detached(int on, void (*hook)(spid_t pid));
+void scheduler_poll();
+int scheduler_poll_pending();
+int scheduler_session_jobs(unsigned int session);
+int scheduler_set_perf();
+void scheduler_print_stats();
+struct pcb *new_process(struct CodeSource *code, int budget);
+int fork_process(int n);
 int run_lines_from_process(struct Scheduler *sch, struct pcb *process, int lines);
 spid_t getspid();
@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "limits.h"
+#include "server.h"
+#include "shell.h"
+#include "scheduler.h"
+#include "codestore.h"
+#include "output.h"
+#include "varstore.h"
+#include "symtab.h"
+#include "memgroup.h"
+
+struct Session {
+    unsigned int id;                // high PID bits of its processes
+    int fd;                         // -1 once the client has gone
+    int waiting;                    // the last line's processes are still running
+    int eof;                        // the client will send nothing more
+    int closing;                    // quit was run
+    int done;                       // finished, closed once its output is out
+    uint32_t events;                // epoll events watched
+    char *out;                      // output the client has not taken yet
+    size_t out_len;
+    size_t out_cap;
+    int dropped;                    // fell too far behind: output is discarded
+    size_t len;                     // pending input
+    char in[SERVER_INPUT_MAX];
+    int in_line;                    // a line is being run, one command at a time
+    size_t line_len;
+    size_t line_pos;                // start of its next command
+    char line[SERVER_INPUT_MAX];
+    struct Session *next;
+};
+
+struct {
+    int serving;
+    volatile sig_atomic_t stop;
+    int epfd;
+    unsigned int last_id;
+    struct Session *sessions;
+} server;
+
+void _server_on_signal(int sig) {
+    (void) sig;
+    server.stop = 1;
+}
+
+// Open a listening socket at path (replacing a stale one)
+int _server_listen(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) { return -1; }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { return -1; }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct Session *_server_find(unsigned int id) {
+    for (struct Session *s = server.sessions; s != NULL; s = s->next) {
+        if (s->id == id) { return s; }
+    }
+    return NULL;
+}
+
+struct Session *_server_find_fd(int fd) {
+    for (struct Session *s = server.sessions; s != NULL; s = s->next) {
+        if (s->fd == fd) { return s; }
+    }
+    return NULL;
+}
+
+// Watch a session's socket for input until the client is done sending, and
+// for room while output is queued
+void _server_watch(struct Session *s) {
+    uint32_t events = (s->eof ? 0 : EPOLLIN | EPOLLRDHUP) | (s->out_len > 0 ? EPOLLOUT : 0);
+    if (events == s->events) { return; }
+    struct epoll_event ev = { .events = events, .data.ptr = s };
+    int op = s->events == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    epoll_ctl(server.epfd, op, s->fd, &ev);
+    s->events = events;
+}
+
+// 1 if output to fd must be queued behind earlier output (output layer hook)
+int _server_queued(int fd) {
+    struct Session *s = _server_find_fd(fd);
+    return s != NULL && (s->out_len > 0 || s->dropped);
+}
+
+// Queue output for a client that cannot take it now (output layer hook)
+void _server_queue(int fd, const char *data, size_t len) {
+    struct Session *s = _server_find_fd(fd);
+    if (s == NULL || s->dropped) { return; }
+    if (s->out_len + len > SERVER_BACKLOG_MAX) {
+        // Not reading: end the session rather than hold its output
+        free(s->out);
+        s->out = NULL;
+        s->out_len = s->out_cap = 0;
+        s->dropped = 1;
+        s->closing = 1;
+        _server_watch(s);
+        return;
+    }
+    if (s->out_len + len > s->out_cap) {
+        s->out_cap = s->out_len + len > 2 * s->out_cap ? s->out_len + len : 2 * s->out_cap;
+        s->out = realloc(s->out, s->out_cap);
+    }
+    memcpy(s->out + s->out_len, data, len);
+    s->out_len += len;
+    _server_watch(s);
+}
+
+// Send queued output as far as the client takes it
+void _server_drain(struct Session *s) {
+    size_t sent = 0;
+    while (sent < s->out_len) {
+        ssize_t n = write(s->fd, s->out + sent, s->out_len - sent);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { break; }
+        if (n <= 0) {
+            // The client has gone: nothing more reaches it
+            sent = s->out_len;
+            s->dropped = 1;
+            break;
+        }
+        sent += n;
+    }
+    memmove(s->out, s->out + sent, s->out_len - sent);
+    s->out_len -= sent;
+    _server_watch(s);
+}
+
+// Output goes to the session of the process about to run
+void _server_switch(spid_t pid) {
+    struct Session *s = _server_find(pid >> SESSION_SHIFT);
+    output_set_fd(s != NULL ? s->fd : -1);
+}
+
+// Tell the client its line is done
+void _server_ready(struct Session *s) {
+    output_set_fd(s->fd);
+    output_putc(SERVER_READY);
+    output_flush();
+}
+
+// Accept a client and greet it the way the shell starts
+void _server_accept(int listen_fd) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) { return; }
+
+    // Next free session id
+    unsigned int id = server.last_id;
+    do {
+        id = id % SERVER_SESSIONS_MAX + 1;
+    } while (_server_find(id) != NULL && id != server.last_id);
+    if (_server_find(id) != NULL) {
+        close(fd);  // full
+        return;
+    }
+    server.last_id = id;
+
+    struct Session *s = calloc(1, sizeof(struct Session));
+    s->id = id;
+    s->fd = fd;
+    s->next = server.sessions;
+    server.sessions = s;
+    _server_watch(s);
+
+    output_set_fd(fd);
+    output_printf("Frame Store Size = %d; Variable Store Size = %d\n", MEMORY_MAX_LINES, MEM_SIZE);
+    _server_ready(s);
+}
+
+// Read what the client sent
+void _server_read(struct Session *s) {
+    if (s->eof || s->len == sizeof(s->in) - 1) { return; }  // a full buffer is taken as a line
+    ssize_t n = read(s->fd, s->in + s->len, sizeof(s->in) - 1 - s->len);
+    if (n > 0) {
+        s->len += n;
+    } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+        s->eof = 1;
+        _server_watch(s);
+    }
+}
+
+// Take the next complete line (or a full buffer) from a session's input
+int _server_next_line(struct Session *s, char *line) {
+    char *nl = memchr(s->in, '\n', s->len);
+    size_t len = nl != NULL ? (size_t) (nl - s->in) + 1 : s->len;
+    if (nl == NULL && s->len < sizeof(s->in) - 1 && !(s->eof && s->len > 0)) { return -1; }
+    memcpy(line, s->in, len);
+    line[len] = '\0';
+    memmove(s->in, s->in + len, s->len - len);
+    s->len -= len;
+    return len;
+}
+
+// The current line is over once its last command and processes are done
+void _server_line_done(struct Session *s) {
+    if (s->waiting || s->line_pos < s->line_len) { return; }
+    s->in_line = 0;
+    if (!s->closing) { _server_ready(s); }
+}
+
+// Run the next command of a session (up to a ';', as execute_line would
+// split it), starting a new line if there is one. Return 0 if there was nothing
+// to run.
+int _server_advance(struct Session *s) {
+    if (!s->in_line) {
+        int len = _server_next_line(s, s->line);
+        if (len < 0) { return 0; }
+        s->line_len = len;
+        s->line_pos = 0;
+        s->in_line = 1;
+    }
+
+    char *cmd = s->line + s->line_pos;
+    char *semi = memchr(cmd, ';', s->line_len - s->line_pos);
+    size_t len = semi != NULL ? (size_t) (semi - cmd) : s->line_len - s->line_pos;
+    s->line_pos += len + (semi != NULL);
+
+    scheduler_set_session(s->id);
+    output_set_fd(s->fd);
+    execute_line(cmd, len);
+    output_flush();
+
+    // Commands that started processes finish before the next one runs
+    s->waiting = scheduler_session_jobs(s->id) > 0;
+    _server_line_done(s);
+    return 1;
+}
+
+// End a session and forget its variables
+void _server_close(struct Session *s) {
+    // Output still buffered for it must not reach a later client given its fd
+    output_set_fd(-1);
+    mem_drop_pids(~SESSION_PID_MASK, s->id << SESSION_SHIFT);
+    memgroup_end_session(s->id);
+    struct Session **link = &server.sessions;
+    while (*link != s) { link = &(*link)->next; }
+    *link = s->next;
+    if (s->fd >= 0) { close(s->fd); }  // also leaves the epoll set
+    free(s->out);
+    free(s);
+}
+
+// Advance every session as far as it can go without blocking. Return 1 if
+// some session has input left to run.
+int _server_step() {
+    int pending = 0;
+    struct Session *s = server.sessions;
+    while (s != NULL) {
+        struct Session *next = s->next;
+        if (s->waiting && scheduler_session_jobs(s->id) == 0) {
+            s->waiting = 0;
+            _server_line_done(s);
+        }
+
+        if (!s->waiting && !s->closing && !s->done && _server_advance(s)) {
+            pending |= s->in_line || s->len > 0 || s->eof;
+        }
+
+        if (!s->waiting && !s->done && (s->closing || (s->eof && s->len == 0 && !s->in_line))) {
+            if (!s->closing) {
+                // As the shell does at the end of its input
+                output_set_fd(s->fd);
+                output_printf("\n");
+                output_flush();
+            }
+            s->done = 1;
+        }
+        if (s->done && (s->out_len == 0 || s->dropped)) { _server_close(s); }
+        s = next;
+    }
+    return pending;
+}
+
+// Serve sessions until interrupted
+int server_run(const char *path) {
+    int listen_fd = _server_listen(path);
+    if (listen_fd < 0) {
+        fprintf(stderr, "server: could not listen on '%s'\n", path);
+        return 1;
+    }
+    server.epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(server.epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    signal(SIGPIPE, SIG_IGN);  // a client hanging up must not end the server
+    struct sigaction sa = { .sa_handler = _server_on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    server.serving = 1;
+    scheduler_set_detached(1, _server_switch);
+    output_set_queue(_server_queued, _server_queue);
+    int busy = 0;
+    while (!server.stop) {
+        struct epoll_event events[SERVER_EVENTS];
+        int n = epoll_wait(server.epfd, events, SERVER_EVENTS, busy ? 0 : -1);
+        if (n < 0 && errno != EINTR) { break; }
+        for (int i = 0; i < n; i++) {
+            struct Session *s = events[i].data.ptr;
+            if (s == NULL) {
+                _server_accept(listen_fd);
+                continue;
+            }
+            if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR) && s->out_len > 0) { _server_drain(s); }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) { _server_read(s); }
+        }
+
+        // A round of every scheduler, then whatever the sessions can run
+        scheduler_poll();
+        busy = _server_step();
+        busy |= scheduler_poll_pending();
+    }
+
+    output_set_queue(NULL, NULL);
+    while (server.sessions != NULL) { _server_close(server.sessions); }
+    close(listen_fd);
+    unlink(path);
+    output_set_fd(STDOUT_FILENO);
+    codestore_terminate();
+    scheduler_free();
+    symtab_free();
+    return 0;
+}
+
+// quit in a session ends that session only. Return 0 if not serving.
+int server_end_session() {
+    if (!server.serving) { return 0; }
+    struct Session *s = _server_find(getspid() >> SESSION_SHIFT);
+    if (s != NULL) { s->closing = 1; }
+    return 1;
+}
+
+// Write all of a buffer
+int _client_write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return 1; }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Copy server output to stdout until the server is ready for another line.
+// Return 0 once the server has hung up.
+int _client_copy_until_ready(int fd) {
+    char buf[4096];
+    while (1) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return 0; }
+        char *ready = memchr(buf, SERVER_READY, n);
+        _client_write_all(STDOUT_FILENO, buf, ready != NULL ? ready - buf : n);
+        if (ready != NULL) { return 1; }  // nothing follows until the next line is sent
+    }
+}
+
+// Run a shell session on a server, with the shell's own prompt and batch behavior
+int client_run(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (strlen(path) >= sizeof(addr.sun_path) || fd < 0) {
+        fprintf(stderr, "client: could not connect to '%s'\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "client: could not connect to '%s'\n", path);
+        close(fd);
+        return 1;
+    }
+
+    int interactive = isatty(STDIN_FILENO);
+    char line[MAX_USER_INPUT + 1];
+    while (_client_copy_until_ready(fd)) {
+        if (interactive) { _client_write_all(STDOUT_FILENO, "$ ", 2); }
+        if (fgets(line, MAX_USER_INPUT - 1, stdin) == NULL) {
+            // End of input: the server finishes the session and hangs up
+            shutdown(fd, SHUT_WR);
+            while (_client_copy_until_ready(fd)) { }
+            break;
+        }
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') { line[len++] = '\n'; }
+        if (_client_write_all(fd, line, len)) { break; }
+    }
+    close(fd);
+    return 0;
+}
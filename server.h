@@ -0,0 +1,28 @@
+/*
+ *  Serving several shell sessions from one process.
+ *  `mysh --serve SOCKET` accepts clients on a UNIX domain socket. Every session
+ *  has its own variables and PIDs (its id is kept in the high PID bits) and
+ *  its own output stream, while all of them share the code store, the frame
+ *  store and the schedulers. Lines of one session run in order: the next line
+ *  is read once everything the previous one started has finished. Processes
+ *  of different sessions share scheduler rounds.
+ *
+ *  Clients are written to without blocking: output a client is not reading
+ *  yet is queued for it, and a client that falls SERVER_BACKLOG_MAX bytes
+ *  behind is disconnected, so one stalled client never holds up the others.
+ *
+ *  `mysh --connect SOCKET` is the client. After each line the server sends
+ *  SERVER_READY, so the client can prompt the way the shell does.
+ */
+
+#pragma once
+
+#define SERVER_READY '\0'               // end of the output for a line
+#define SERVER_SESSIONS_MAX 2047        // session ids must fit above SESSION_SHIFT in a PID
+#define SERVER_INPUT_MAX MAX_USER_INPUT // a longer line is split, as fgets() would
+#define SERVER_EVENTS 64
+#define SERVER_BACKLOG_MAX (1024 * 1024) // output queued for a client that is not reading, before it is dropped
+
+int server_run(const char *path);
+int server_end_session();
+int client_run(const char *path);
@@ -9,22 +9,101 @@
 #include "varstore.h"
 #include "codestore.h"
 #include "scheduler.h"
+#include "output.h"
+#include "events.h"
+#include "codesource.h"
+#include "simdscan.h"
+#include "ztier.h"
+#include "profile.h"
+#include "server.h"
+#include "frameshm.h"
+#include "vtime.h"
+#include "symtab.h"
 
 #define CMD_DELIM ";"
 #define PROMPT '$'
 
+int usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--flush line|size|slice] [--flush-kb N] [--no-mmap] [--no-ztier] [--no-dedup]\n"
+        "       [--profile FILE] [--quiet-events] [--event-dump FILE] [--admission-control] [--perf] [--varstore FILE]\n"
+        "       [--shared-frames NAME] [--vtime] [--vtime-insn N] [--vtime-pagein DIST] [--vtime-evict DIST]\n"
+        "       [--vtime-seed N] [--serve SOCKET | --connect SOCKET]\n"
+        "DIST is fixed:N, uniform:LO-HI or exp:MEAN (virtual ticks)\n", prog);
+    return 1;
+}
+
 // Start of everything
 int main(int argc, char *argv[]) {
-    printf("Frame Store Size = %d; Variable Store Size = %d\n", MEMORY_MAX_LINES, MEM_SIZE);
+    // Output flushing: per line when interactive, by size in batch mode
+    enum OutputPolicy policy = isatty(STDIN_FILENO) ? OUTPUT_FLUSH_LINE : OUTPUT_FLUSH_SIZE;
+    size_t flush_kb = 0;
+    const char *serve = NULL;       // socket to serve sessions on
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--flush") == 0 && i + 1 < argc) {
+            if (output_parse_policy(argv[++i], &policy)) { return usage(argv[0]); }
+        } else if (strcmp(argv[i], "--flush-kb") == 0 && i + 1 < argc) {
+            flush_kb = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--no-mmap") == 0) {
+            codesource_set_mmap(0);
+        } else if (strcmp(argv[i], "--no-ztier") == 0) {
+            ztier_set_enabled(0);
+        } else if (strcmp(argv[i], "--no-dedup") == 0) {
+            codestore_set_dedup(0);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_open(argv[++i]);
+        } else if (strcmp(argv[i], "--quiet-events") == 0) {
+            events_set_quiet(1);
+        } else if (strcmp(argv[i], "--event-dump") == 0 && i + 1 < argc) {
+            events_set_dump_path(argv[++i]);
+        } else if (strcmp(argv[i], "--admission-control") == 0) {
+            scheduler_set_admission_control(1);
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            if (scheduler_set_perf()) { fprintf(stderr, "mysh: no hardware counters, continuing without them\n"); }
+        } else if (strcmp(argv[i], "--varstore") == 0 && i + 1 < argc) {
+            mem_set_file(argv[++i]);
+        } else if (strcmp(argv[i], "--shared-frames") == 0 && i + 1 < argc) {
+            frameshm_set_name(argv[++i]);
+        } else if (strcmp(argv[i], "--vtime") == 0) {
+            vtime_set_enabled(1);
+        } else if (strcmp(argv[i], "--vtime-insn") == 0 && i + 1 < argc) {
+            vtime_set_insn_ticks(strtoull(argv[++i], NULL, 10));
+            vtime_set_enabled(1);
+        } else if (strcmp(argv[i], "--vtime-pagein") == 0 && i + 1 < argc) {
+            if (vtime_set_latency(VTIME_REQ_PAGE_IN, argv[++i])) { return usage(argv[0]); }
+            vtime_set_enabled(1);
+        } else if (strcmp(argv[i], "--vtime-evict") == 0 && i + 1 < argc) {
+            if (vtime_set_latency(VTIME_REQ_EVICT, argv[++i])) { return usage(argv[0]); }
+            vtime_set_enabled(1);
+        } else if (strcmp(argv[i], "--vtime-seed") == 0 && i + 1 < argc) {
+            vtime_set_seed(strtoull(argv[++i], NULL, 10));
+            vtime_set_enabled(1);
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve = argv[++i];
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            return client_run(argv[++i]);  // the server does everything else
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    output_init(STDOUT_FILENO, policy, flush_kb);
+    atexit(output_flush);
+    atexit(events_dump_at_exit);
+    atexit(profile_save);
+
+    if (serve == NULL) { output_printf("Frame Store Size = %d; Variable Store Size = %d\n", MEMORY_MAX_LINES, MEM_SIZE); }
     // printf("Shell version 1.3 created September 2024\n\n");
     //help();
 
     // init shell memory
-    mem_init();
+    if (mem_init()) { return 1; }
+    atexit(mem_close);
 
-    // init code store
+    // init code store (shared with other shells if asked)
+    if (frameshm_open()) { return 1; }
+    atexit(frameshm_close);
     init_code_store();
 
+    if (serve != NULL) { return server_run(serve); }
     return run_shell(stdin);
 }
 
@@ -42,65 +121,68 @@ int run_shell(FILE *input_stream) {
     char *ret_val;      // fgets return value
     while(1) {
         // Print the prompt
-        if (shellIsInteractive) { printf("%c ", PROMPT); }
+        if (shellIsInteractive) { output_printf("%c ", PROMPT); }
 
-        // Get input
+        // Get input (everything printed so far must be visible first)
+        if (shellIsInteractive) { output_flush(); }
         ret_val = fgets(userInput, MAX_USER_INPUT-1, input_stream);
 
         if (ret_val == NULL) {
             // Reached EOF
-            printf("\n");
+            output_printf("\n");
             break;  // exit
         } else {
-            execute_line(userInput);
+            execute_line(userInput, strlen(userInput));
         }
         memset(userInput, 0, sizeof(userInput));
     }
 
     codestore_terminate();
     scheduler_free();
+    symtab_free();
 
     return 0;
 }
 
 // Run a line of code
-void execute_line(char *line) {
+void execute_line(const char *line, size_t len) {
+    char buffer[MAX_USER_INPUT];   // private copy, strtok writes into it
     char *cmd;          // command to execute
+    char *saveptr;      // strtok state (scripts run nested inside a top-level line)
     int errorCode;      // command error code
 
+    if (len > sizeof(buffer) - 1) { len = sizeof(buffer) - 1; }
+    memcpy(buffer, line, len);
+    buffer[len] = '\0';
+
     // Split one-liners
-    cmd = strtok(strdup(line), CMD_DELIM);
+    cmd = strtok_r(buffer, CMD_DELIM, &saveptr);
     while (cmd != NULL) {
         errorCode = parseInput(cmd);        // run the command
         if (errorCode == -1) exit(99);	// ignore all other errors
-        cmd = strtok(NULL, CMD_DELIM);
+        cmd = strtok_r(NULL, CMD_DELIM, &saveptr);
     }
 }
 
-int wordEnding(char c) {
-    // You may want to add ';' to this at some point,
-    // or you may want to find a different way to implement chains.
-    return c == '\0' || c == '\n' || c == ' ' || c == ';';
-}
-
 int parseInput(char inp[]) {
-    char tmp[200], *words[100];                            
-    int ix = 0, w = 0;
-    int wordlen;
+    char tmp[2 * MAX_USER_INPUT], *words[100];      // words are packed into tmp
+    char *word = tmp;
+    int w = 0;
     int errorCode;
-    for (ix = 0; inp[ix] == ' ' && ix < 1000; ix++); // skip white spaces
-    while (inp[ix] != '\n' && inp[ix] != '\0' && ix < 1000) {
-        // extract a word
-        for (wordlen = 0; !wordEnding(inp[ix]) && ix < 1000; ix++, wordlen++) {
-            tmp[wordlen] = inp[ix];                        
-        }
-        tmp[wordlen] = '\0';
-        words[w] = strdup(tmp);
+    const char *p = inp;
+    const char *end = inp + strnlen(inp, 1000);
+    while (p < end && *p == ' ') { p++; }           // skip white spaces
+    while (p < end && *p != '\n' && w < 100) {
+        // extract a word, up to the next space, ';', newline or end
+        const char *stop = scan_find_delim(p, end);
+        memcpy(word, p, stop - p);
+        word[stop - p] = '\0';
+        words[w] = word;
+        word += stop - p + 1;
         w++;
-        if (inp[ix] == '\0') break;
-        ix++; 
+        if (stop == end || *stop == '\0') break;
+        p = stop + 1;
     }
     errorCode = interpreter(words, w);
     return errorCode;
 }
-
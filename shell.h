@@ -4,4 +4,4 @@
 
 int parseInput(char inp[]);
 int run_shell(FILE *input_stream);
-void execute_line(char *line);
+void execute_line(const char *line, size_t len);
@@ -0,0 +1,171 @@
+#include <string.h>
+
+#include "simdscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// Scalar kernels
+
+size_t _scan_count_byte_scalar(const char *buf, size_t len, char c) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) { n += buf[i] == c; }
+    return n;
+}
+
+size_t _scan_newline_offsets_scalar(const char *buf, size_t len, size_t base, size_t *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '\n') { out[n++] = base + i + 1; }
+    }
+    return n;
+}
+
+int _scan_is_delim(char c) {
+    return c == ' ' || c == ';' || c == '\n' || c == '\0';
+}
+
+const char *_scan_find_delim_scalar(const char *p, const char *end) {
+    while (p < end && !_scan_is_delim(*p)) { p++; }
+    return p;
+}
+
+#ifdef SCAN_X86
+
+// SSE2 kernels (16 bytes per step)
+
+size_t _scan_count_byte_sse2(const char *buf, size_t len, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    size_t n = 0, i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (buf + i));
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+    }
+    return n + _scan_count_byte_scalar(buf + i, len - i, c);
+}
+
+size_t _scan_newline_offsets_sse2(const char *buf, size_t len, size_t base, size_t *out) {
+    __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0, i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (buf + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+        while (mask) {
+            out[n++] = base + i + __builtin_ctz(mask) + 1;
+            mask &= mask - 1;
+        }
+    }
+    return n + _scan_newline_offsets_scalar(buf + i, len - i, base + i, out + n);
+}
+
+const char *_scan_find_delim_sse2(const char *p, const char *end) {
+    __m128i space = _mm_set1_epi8(' '), semi = _mm_set1_epi8(';');
+    __m128i nl = _mm_set1_epi8('\n'), nul = _mm_setzero_si128();
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) p);
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, semi)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, nl), _mm_cmpeq_epi8(chunk, nul))
+        );
+        unsigned mask = _mm_movemask_epi8(hit);
+        if (mask) { return p + __builtin_ctz(mask); }
+    }
+    return _scan_find_delim_scalar(p, end);
+}
+
+// AVX2 kernels (32 bytes per step)
+
+__attribute__((target("avx2,popcnt")))
+size_t _scan_count_byte_avx2(const char *buf, size_t len, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t n = 0, i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) (buf + i));
+        n += __builtin_popcount((unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+    }
+    return n + _scan_count_byte_sse2(buf + i, len - i, c);
+}
+
+__attribute__((target("avx2,bmi")))
+size_t _scan_newline_offsets_avx2(const char *buf, size_t len, size_t base, size_t *out) {
+    __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0, i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) (buf + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, nl));
+        while (mask) {
+            out[n++] = base + i + __builtin_ctz(mask) + 1;
+            mask &= mask - 1;
+        }
+    }
+    return n + _scan_newline_offsets_sse2(buf + i, len - i, base + i, out + n);
+}
+
+__attribute__((target("avx2,bmi")))
+const char *_scan_find_delim_avx2(const char *p, const char *end) {
+    __m256i space = _mm256_set1_epi8(' '), semi = _mm256_set1_epi8(';');
+    __m256i nl = _mm256_set1_epi8('\n'), nul = _mm256_setzero_si256();
+    for (; end - p >= 32; p += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, semi)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, nl), _mm256_cmpeq_epi8(chunk, nul))
+        );
+        unsigned mask = _mm256_movemask_epi8(hit);
+        if (mask) { return p + __builtin_ctz(mask); }
+    }
+    return _scan_find_delim_sse2(p, end);
+}
+
+#endif
+
+const struct ScanKernels scan_all_kernels[] = {
+    { "scalar", _scan_count_byte_scalar, _scan_newline_offsets_scalar, _scan_find_delim_scalar, _scan_find_delim_scalar },
+#ifdef SCAN_X86
+    { "sse2", _scan_count_byte_sse2, _scan_newline_offsets_sse2, _scan_find_delim_scalar, _scan_find_delim_sse2 },
+    { "avx2", _scan_count_byte_avx2, _scan_newline_offsets_avx2, _scan_find_delim_scalar, _scan_find_delim_avx2 },
+#endif
+};
+
+#define SCAN_N_KERNELS (sizeof(scan_all_kernels) / sizeof(scan_all_kernels[0]))
+
+const struct ScanKernels *scan_kernels = &scan_all_kernels[0];
+
+// 1 if the CPU can run a kernel set
+int _scan_supported(const struct ScanKernels *k) {
+#ifdef SCAN_X86
+    if (strcmp(k->name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("popcnt");
+    }
+    if (strcmp(k->name, "sse2") == 0) { return __builtin_cpu_supports("sse2"); }
+#endif
+    return 1;
+}
+
+// Pick the widest supported kernels before main() runs
+__attribute__((constructor))
+void _scan_detect() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+#endif
+    for (size_t i = 0; i < SCAN_N_KERNELS; i++) {
+        if (_scan_supported(&scan_all_kernels[i])) { scan_kernels = &scan_all_kernels[i]; }
+    }
+}
+
+// Force a kernel set by name. Return 0 on success, 1 if unknown or unsupported.
+int scan_use(const char *name) {
+    for (size_t i = 0; i < SCAN_N_KERNELS; i++) {
+        if (strcmp(scan_all_kernels[i].name, name) == 0 && _scan_supported(&scan_all_kernels[i])) {
+            scan_kernels = &scan_all_kernels[i];
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const char *scan_impl_name() {
+    return scan_kernels->name;
+}
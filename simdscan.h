@@ -0,0 +1,40 @@
+/*
+ *  Byte scanning kernels for script text: newline counting, line start
+ *  offsets and command delimiter search. SSE2/AVX2 versions are picked at
+ *  startup from what the CPU supports, with a scalar fallback.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+struct ScanKernels {
+    const char *name;
+    size_t (*count_byte)(const char *buf, size_t len, char c);
+    size_t (*newline_offsets)(const char *buf, size_t len, size_t base, size_t *out);
+    const char *(*find_delim)(const char *p, const char *end);
+    // Vector delimiter search. Shell tokens are shorter than a vector, so
+    // find_delim stays scalar in every set; scanbench still measures these.
+    const char *(*find_delim_wide)(const char *p, const char *end);
+};
+
+extern const struct ScanKernels *scan_kernels;
+
+// Number of occurrences of c in buf
+static inline size_t scan_count_byte(const char *buf, size_t len, char c) {
+    return scan_kernels->count_byte(buf, len, c);
+}
+
+// For every newline at buf[i], write base + i + 1 (where the next line starts)
+// to out. Return the number written; out must have room for one per newline.
+static inline size_t scan_newline_offsets(const char *buf, size_t len, size_t base, size_t *out) {
+    return scan_kernels->newline_offsets(buf, len, base, out);
+}
+
+// First ' ', ';', '\n' or '\0' in [p, end), or end if there is none
+static inline const char *scan_find_delim(const char *p, const char *end) {
+    return scan_kernels->find_delim(p, end);
+}
+
+int scan_use(const char *name);
+const char *scan_impl_name();
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "slab.h"
+#include "output.h"
+
+#define SLAB_ALIGN 16
+
+// Number of chunk mallocs made by all slabs, so the steady state can be checked for zero.
+unsigned long slab_mallocs = 0;
+
+void _slab_throw_error(const char *msg) {
+    output_printf("slab: Runtime error: %s\n", msg);
+    exit(99);
+}
+
+// Object stride: big enough for a free list link, aligned like malloc would.
+size_t _slab_stride(struct Slab *s) {
+    size_t size = s->obj_size < sizeof(void *) ? sizeof(void *) : s->obj_size;
+    return (size + SLAB_ALIGN - 1) & ~(size_t) (SLAB_ALIGN - 1);
+}
+
+// Header size of a chunk, rounded so the first object is aligned
+size_t _slab_header() {
+    return (sizeof(struct SlabChunk) + SLAB_ALIGN - 1) & ~(size_t) (SLAB_ALIGN - 1);
+}
+
+// Thread every object of a chunk onto the free list
+void _slab_carve(struct Slab *s, struct SlabChunk *chunk) {
+    char *base = (char *) chunk + _slab_header();
+    size_t stride = _slab_stride(s);
+    for (size_t i = s->per_chunk; i > 0; i--) {
+        void **obj = (void **) (base + (i - 1) * stride);
+        *obj = s->free_list;
+        s->free_list = obj;
+    }
+}
+
+// Allocate one object
+void *slab_alloc(struct Slab *s) {
+    if (s->free_list == NULL) {
+        struct SlabChunk *chunk = malloc(_slab_header() + s->per_chunk * _slab_stride(s));
+        if (chunk == NULL) { _slab_throw_error("out of memory."); }
+        slab_mallocs++;
+        chunk->next = s->chunks;
+        s->chunks = chunk;
+        _slab_carve(s, chunk);
+    }
+    void **obj = s->free_list;
+    s->free_list = *obj;
+    s->live++;
+    return obj;
+}
+
+// Return one object to its slab
+void slab_free(struct Slab *s, void *obj) {
+    if (obj == NULL) { return; }
+    *(void **) obj = s->free_list;
+    s->free_list = obj;
+    s->live--;
+}
+
+// Give every chunk back to the C heap
+void slab_release(struct Slab *s) {
+    while (s->chunks != NULL) {
+        struct SlabChunk *next = s->chunks->next;
+        free(s->chunks);
+        s->chunks = next;
+    }
+    s->free_list = NULL;
+    s->live = 0;
+}
+
+unsigned long slab_alloc_count() {
+    return slab_mallocs;
+}
@@ -0,0 +1,29 @@
+/*
+ *  Type-specific object pools.
+ *  Objects are carved out of chunks and recycled through a free list, so the
+ *  steady state allocates nothing from the C heap.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+struct SlabChunk {
+    struct SlabChunk *next;
+};
+
+struct Slab {
+    const char *name;
+    size_t obj_size;
+    size_t per_chunk;               // objects carved out of each chunk
+    void *free_list;
+    struct SlabChunk *chunks;
+    size_t live;                    // objects currently handed out
+};
+
+#define SLAB_INIT(type, n) { .name = #type, .obj_size = sizeof(type), .per_chunk = (n) }
+
+void *slab_alloc(struct Slab *s);
+void slab_free(struct Slab *s, void *obj);
+void slab_release(struct Slab *s);
+unsigned long slab_alloc_count();
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symtab.h"
+#include "output.h"
+
+struct {
+    sym_t *index;                   // open addressing by name hash, 0 if empty
+    size_t index_size;
+    char **names;                   // by ID (names[0] unused)
+    uint32_t *hashes;
+    sym_t n;                        // IDs handed out, plus one
+    sym_t capacity;
+} symtab = {
+    .n = 1,
+};
+
+void _symtab_throw_error(const char *msg) {
+    output_printf("symtab: Runtime error: %s\n", msg);
+    exit(99);
+}
+
+// FNV-1a
+uint32_t _symtab_hash(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Index slot holding a name, or the empty slot where it would go
+sym_t *_symtab_probe(const char *name, size_t len, uint32_t hash) {
+    size_t mask = symtab.index_size - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        sym_t sym = symtab.index[i];
+        if (sym == 0) { return &symtab.index[i]; }
+        if (symtab.hashes[sym] == hash && strncmp(symtab.names[sym], name, len) == 0 && symtab.names[sym][len] == '\0') {
+            return &symtab.index[i];
+        }
+    }
+}
+
+// Double the index (and the ID arrays when they are full)
+void _symtab_grow() {
+    if (symtab.n >= symtab.capacity) {
+        symtab.capacity = symtab.capacity == 0 ? SYMTAB_INITIAL : symtab.capacity * 2;
+        symtab.names = realloc(symtab.names, symtab.capacity * sizeof(*symtab.names));
+        symtab.hashes = realloc(symtab.hashes, symtab.capacity * sizeof(*symtab.hashes));
+        if (symtab.names == NULL || symtab.hashes == NULL) { _symtab_throw_error("out of memory."); }
+    }
+    if (2 * (size_t) symtab.n < symtab.index_size) { return; }
+
+    size_t size = symtab.index_size == 0 ? SYMTAB_INITIAL : symtab.index_size * 2;
+    free(symtab.index);
+    symtab.index = calloc(size, sizeof(*symtab.index));
+    if (symtab.index == NULL) { _symtab_throw_error("out of memory."); }
+    symtab.index_size = size;
+    for (sym_t sym = 1; sym < symtab.n; sym++) {
+        size_t i = symtab.hashes[sym] & (size - 1);
+        while (symtab.index[i] != 0) { i = (i + 1) & (size - 1); }
+        symtab.index[i] = sym;
+    }
+}
+
+// Get the ID of a name, adding it if it is new
+sym_t symtab_intern(const char *name, size_t len) {
+    _symtab_grow();
+    uint32_t hash = _symtab_hash(name, len);
+    sym_t *slot = _symtab_probe(name, len, hash);
+    if (*slot != 0) { return *slot; }
+
+    sym_t sym = symtab.n++;
+    symtab.names[sym] = strndup(name, len);
+    symtab.hashes[sym] = hash;
+    *slot = sym;
+    return sym;
+}
+
+// Get the ID of a name, 0 if it was never interned
+sym_t symtab_find(const char *name, size_t len) {
+    if (symtab.index_size == 0) { return 0; }
+    return *_symtab_probe(name, len, _symtab_hash(name, len));
+}
+
+const char *symtab_name(sym_t sym) {
+    if (sym == 0 || sym >= symtab.n) { _symtab_throw_error("unknown symbol."); }
+    return symtab.names[sym];
+}
+
+// IDs handed out so far are below this
+sym_t symtab_count() {
+    return symtab.n;
+}
+
+// Intern the variables a script line names: the operand of set and print,
+// and every $-reference
+void symtab_decode_line(const char *text, size_t len) {
+    const char *end = text + len;
+    const char *p = text;
+    int word = 0;               // position in the current command
+    int names_var = 0;          // the next word is a variable name
+    while (p < end) {
+        if (*p == ' ' || *p == '\n' || *p == '\r') { p++; continue; }
+        if (*p == ';') { word = 0; names_var = 0; p++; continue; }
+
+        const char *start = p;
+        while (p < end && *p != ' ' && *p != ';' && *p != '\n' && *p != '\r' && *p != '\0') { p++; }
+        size_t n = p - start;
+        if (start[0] == '$' && n > 1) {
+            symtab_intern(start + 1, n - 1);
+        } else if (names_var) {
+            symtab_intern(start, n);
+        }
+        names_var = word == 0 && ((n == 3 && strncmp(start, "set", 3) == 0) || (n == 5 && strncmp(start, "print", 5) == 0));
+        word++;
+        if (p < end && *p == '\0') { break; }
+    }
+}
+
+// Release the table (at shell termination)
+void symtab_free() {
+    for (sym_t sym = 1; sym < symtab.n; sym++) { free(symtab.names[sym]); }
+    free(symtab.names);
+    free(symtab.hashes);
+    free(symtab.index);
+    symtab = (typeof(symtab)) { .n = 1 };
+}
@@ -0,0 +1,23 @@
+/*
+ *  Interned variable names.
+ *  Every name a script refers to gets a small dense ID, assigned when the line
+ *  naming it is loaded into a frame. The variable store indexes per-process
+ *  slot arrays by these IDs, so finding a variable does not compare names.
+ *  IDs are only meaningful for the life of the shell.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYMTAB_INITIAL 256          // hash slots at first (power of two, grows at 1/2 full)
+
+typedef uint32_t sym_t;             // 0 is no symbol
+
+sym_t symtab_intern(const char *name, size_t len);
+sym_t symtab_find(const char *name, size_t len);
+const char *symtab_name(sym_t sym);
+sym_t symtab_count();
+void symtab_decode_line(const char *text, size_t len);
+void symtab_free();
@@ -3,7 +3,13 @@
 
 #include "limits.h"
 
-typedef char (*frame_t)[CMD_MAX_CHARS];
+// A line held in a frame. Points into a mapped script or into the frame store.
+struct LineSpan {
+    const char *text;       // NULL past the end of the script
+    unsigned int len;
+};
+
+typedef struct LineSpan *frame_t;
 typedef int page_num_t;
 typedef int frame_num_t;
 typedef unsigned int spid_t;
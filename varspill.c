@@ -0,0 +1,382 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "varspill.h"
+#include "output.h"
+
+// Where a spilled variable's record is (sym 0 marks an empty entry)
+struct VarSpillEntry {
+    int32_t pid;
+    sym_t sym;
+    uint32_t len;                   // of the whole record
+    uint64_t offset;
+};
+
+struct {
+    char *path;                     // NULL for an unlinked temporary file
+    FILE *tmp;
+    int fd;                         // -1 until the first spill
+    uint64_t end;                   // where the next record goes
+    uint64_t live_bytes;
+    uint64_t dead_bytes;
+
+    // Open addressing by (PID, symbol), linear probing
+    struct VarSpillEntry *index;
+    size_t size;
+    size_t n;
+
+    char *buf;                      // last variable read back
+    size_t cap;
+
+    unsigned long spills;
+    unsigned long faults;
+    unsigned long compactions;
+} spill = {
+    .fd = -1,
+};
+
+size_t _varspill_hash(int pid, sym_t sym) {
+    return ((uint32_t) pid * 2654435761u) ^ (sym * 2246822519u);
+}
+
+// Entry of a variable, or the empty entry where it would go
+size_t _varspill_probe(int pid, sym_t sym) {
+    size_t mask = spill.size - 1;
+    size_t i = _varspill_hash(pid, sym) & mask;
+    while (spill.index[i].sym != 0 && (spill.index[i].pid != pid || spill.index[i].sym != sym)) { i = (i + 1) & mask; }
+    return i;
+}
+
+// Rebuild the index at a size, keeping its entries
+void _varspill_rehash(size_t size) {
+    struct VarSpillEntry *old = spill.index;
+    size_t old_size = spill.size;
+    spill.index = calloc(size, sizeof(*spill.index));
+    if (spill.index == NULL) {
+        output_printf("varspill: Runtime error: out of memory.\n");
+        exit(99);
+    }
+    spill.size = size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].sym != 0) { spill.index[_varspill_probe(old[i].pid, old[i].sym)] = old[i]; }
+    }
+    free(old);
+}
+
+void _varspill_insert(struct VarSpillEntry e) {
+    if (2 * (spill.n + 1) > spill.size) { _varspill_rehash(spill.size == 0 ? VARSPILL_INDEX_INITIAL : 2 * spill.size); }
+    spill.index[_varspill_probe(e.pid, e.sym)] = e;
+    spill.n++;
+    spill.live_bytes += e.len;
+}
+
+// Remove an entry, shifting back the ones probing past it
+void _varspill_remove_at(size_t i) {
+    size_t mask = spill.size - 1;
+    spill.index[i].sym = 0;
+    spill.n--;
+    for (size_t j = (i + 1) & mask; spill.index[j].sym != 0; j = (j + 1) & mask) {
+        size_t home = _varspill_hash(spill.index[j].pid, spill.index[j].sym) & mask;
+        // Move j into the hole unless its home lies cyclically in (i, j]
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            spill.index[i] = spill.index[j];
+            spill.index[j].sym = 0;
+            i = j;
+        }
+    }
+}
+
+// Mark an entry's record dead in the file
+void _varspill_kill(struct VarSpillEntry *e) {
+    uint32_t dead = 0;
+    if (pwrite(spill.fd, &dead, sizeof(dead), e->offset) != sizeof(dead)) {
+        output_printf("varspill: Runtime error: could not write the spill file.\n");
+        exit(99);
+    }
+    spill.live_bytes -= e->len;
+    spill.dead_bytes += e->len;
+}
+
+// Append a record. Return its entry (len 0 if it could not be written).
+struct VarSpillEntry _varspill_append(int fd, uint64_t *end, int pid, sym_t sym, const char *value, size_t value_len) {
+    const char *var = symtab_name(sym);
+    struct VarSpillRecord r = { VARSPILL_LIVE, pid, strlen(var), value_len };
+    struct iovec iov[3] = {
+        { &r, sizeof(r) },
+        { (void *) var, r.var_len },
+        { (void *) value, r.value_len },
+    };
+    size_t len = sizeof(r) + r.var_len + r.value_len;
+    struct VarSpillEntry e = { .pid = pid, .sym = sym, .len = 0, .offset = *end };
+    if (pwritev(fd, iov, 3, *end) != (ssize_t) len) { return e; }
+    e.len = len;
+    *end += len;
+    return e;
+}
+
+// Read an entry's name and value into the buffer, each NUL-terminated.
+// Return the value.
+const char *_varspill_read(struct VarSpillEntry *e, const char **var) {
+    if (spill.cap < e->len + 2) {
+        spill.cap = e->len + 2;
+        spill.buf = realloc(spill.buf, spill.cap);
+    }
+    struct VarSpillRecord r;
+    if (pread(spill.fd, &r, sizeof(r), e->offset) != sizeof(r) || r.live != VARSPILL_LIVE
+        || sizeof(r) + r.var_len + r.value_len != e->len
+        || pread(spill.fd, spill.buf, r.var_len, e->offset + sizeof(r)) != r.var_len
+        || pread(spill.fd, spill.buf + r.var_len + 1, r.value_len, e->offset + sizeof(r) + r.var_len) != r.value_len) {
+        output_printf("varspill: Runtime error: could not read the spill file.\n");
+        exit(99);
+    }
+    spill.buf[r.var_len] = '\0';
+    spill.buf[r.var_len + 1 + r.value_len] = '\0';
+    if (var != NULL) { *var = spill.buf; }
+    return spill.buf + r.var_len + 1;
+}
+
+// Write the header of an empty spill file
+int _varspill_init_file(int fd) {
+    return pwrite(fd, VARSPILL_MAGIC, sizeof(VARSPILL_MAGIC) - 1, 0) == sizeof(VARSPILL_MAGIC) - 1 ? 0 : 1;
+}
+
+// Open the spill file on first use. Return 0 on success.
+int _varspill_file() {
+    if (spill.fd >= 0) { return 0; }
+    spill.tmp = tmpfile();
+    if (spill.tmp == NULL) { return 1; }
+    spill.fd = fileno(spill.tmp);
+    spill.end = sizeof(VARSPILL_MAGIC) - 1;
+    return _varspill_init_file(spill.fd);
+}
+
+// Copy the live records to a new file, noting their offsets there. Return 0
+// on success.
+int _varspill_copy_live(int fd, uint64_t *end, uint64_t *offsets) {
+    if (_varspill_init_file(fd)) { return 1; }
+    *end = sizeof(VARSPILL_MAGIC) - 1;
+    for (size_t i = 0; i < spill.size; i++) {
+        struct VarSpillEntry *e = &spill.index[i];
+        if (e->sym == 0) { continue; }
+        const char *value = _varspill_read(e, NULL);
+        struct VarSpillEntry moved = _varspill_append(fd, end, e->pid, e->sym, value, strlen(value));
+        if (moved.len == 0) { return 1; }
+        offsets[i] = moved.offset;
+    }
+    return 0;
+}
+
+// Rewrite the file with only its live records (keeping the old one if that fails)
+void _varspill_compact() {
+    int fd;
+    FILE *tmp = NULL;
+    char path[4096];
+    if (spill.path != NULL) {
+        snprintf(path, sizeof(path), "%s.tmp", spill.path);
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    } else {
+        tmp = tmpfile();
+        fd = tmp == NULL ? -1 : fileno(tmp);
+    }
+    if (fd < 0) { return; }
+
+    uint64_t end;
+    uint64_t *offsets = malloc(spill.size * sizeof(uint64_t));
+    int failed = offsets == NULL || _varspill_copy_live(fd, &end, offsets)
+        || (spill.path != NULL && (fsync(fd) != 0 || rename(path, spill.path) != 0));
+    if (failed) {
+        free(offsets);
+        if (tmp != NULL) {
+            fclose(tmp);
+        } else {
+            close(fd);
+            remove(path);
+        }
+        return;
+    }
+
+    // Swap the new file in
+    for (size_t i = 0; i < spill.size; i++) {
+        if (spill.index[i].sym != 0) { spill.index[i].offset = offsets[i]; }
+    }
+    free(offsets);
+    if (spill.tmp != NULL) { fclose(spill.tmp); } else { close(spill.fd); }
+    spill.tmp = tmp;
+    spill.fd = fd;
+    spill.end = end;
+    spill.dead_bytes = 0;
+    spill.compactions++;
+}
+
+// Use a spill file beside a --varstore file (NULL: a temporary file, created
+// when first needed). Top-level variables found in it are indexed, and
+// those of processes are dropped. Return 0 on success.
+int varspill_open(const char *path) {
+    if (path == NULL) { return 0; }
+    spill.path = strdup(path);
+    spill.fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (spill.fd < 0 || fstat(spill.fd, &st) != 0) {
+        fprintf(stderr, "varstore: could not open '%s'\n", path);
+        return 1;
+    }
+    spill.end = sizeof(VARSPILL_MAGIC) - 1;
+    if (st.st_size == 0) {
+        if (_varspill_init_file(spill.fd) == 0) { return 0; }
+        fprintf(stderr, "varstore: could not write '%s'\n", path);
+        return 1;
+    }
+    char magic[sizeof(VARSPILL_MAGIC) - 1];
+    if (pread(spill.fd, magic, sizeof(magic), 0) != sizeof(magic) || memcmp(magic, VARSPILL_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "varstore: '%s' is not a spill file\n", path);
+        return 1;
+    }
+
+    // Index the live records (a torn one at the end is cut off)
+    struct VarSpillRecord r;
+    while (pread(spill.fd, &r, sizeof(r), spill.end) == sizeof(r)) {
+        uint64_t len = sizeof(r) + (uint64_t) r.var_len + r.value_len;
+        if (spill.end + len > (uint64_t) st.st_size) { break; }
+        struct VarSpillEntry e = { .pid = r.pid, .len = len, .offset = spill.end };
+        spill.end += len;
+        if (r.live != VARSPILL_LIVE) {
+            spill.dead_bytes += len;
+            continue;
+        }
+        if (spill.cap < r.var_len + 1) {
+            spill.cap = r.var_len + 1;
+            spill.buf = realloc(spill.buf, spill.cap);
+        }
+        if (pread(spill.fd, spill.buf, r.var_len, e.offset + sizeof(r)) != r.var_len) { break; }
+        e.sym = symtab_intern(spill.buf, r.var_len);
+
+        if (r.pid != 0) {
+            // A process of an earlier session
+            spill.live_bytes += len;
+            _varspill_kill(&e);
+            continue;
+        }
+        varspill_drop(0, e.sym);    // an older record, set again later in the file
+        _varspill_insert(e);
+    }
+    if (ftruncate(spill.fd, spill.end) != 0) {
+        fprintf(stderr, "varstore: could not repair '%s'\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+void varspill_close() {
+    if (spill.tmp != NULL) {
+        fclose(spill.tmp);
+    } else if (spill.fd >= 0) {
+        fsync(spill.fd);
+        close(spill.fd);
+    }
+    spill.tmp = NULL;
+    spill.fd = -1;
+}
+
+// Spill a variable, replacing a spilled copy. Return 0 on success.
+int varspill_put(int pid, sym_t sym, const char *value) {
+    if (_varspill_file()) { return 1; }
+    struct VarSpillEntry e = _varspill_append(spill.fd, &spill.end, pid, sym, value, strlen(value));
+    if (e.len == 0) { return 1; }
+    varspill_drop(pid, sym);
+    _varspill_insert(e);
+    spill.spills++;
+
+    if (spill.dead_bytes > VARSPILL_COMPACT_MIN && spill.dead_bytes > spill.live_bytes) { _varspill_compact(); }
+    return 0;
+}
+
+// Take a spilled variable back. Return its value (valid until the next call),
+// NULL if it is not spilled.
+const char *varspill_take(int pid, sym_t sym) {
+    if (spill.n == 0) { return NULL; }
+    size_t i = _varspill_probe(pid, sym);
+    if (spill.index[i].sym == 0) { return NULL; }
+    const char *value = _varspill_read(&spill.index[i], NULL);
+    _varspill_kill(&spill.index[i]);
+    _varspill_remove_at(i);
+    spill.faults++;
+    return value;
+}
+
+// Value of a spilled variable (valid until the next call), NULL if it is not
+// spilled
+const char *varspill_get(int pid, sym_t sym) {
+    if (spill.n == 0) { return NULL; }
+    size_t i = _varspill_probe(pid, sym);
+    return spill.index[i].sym == 0 ? NULL : _varspill_read(&spill.index[i], NULL);
+}
+
+// Forget a spilled variable, if it is spilled
+void varspill_drop(int pid, sym_t sym) {
+    if (spill.n == 0) { return; }
+    size_t i = _varspill_probe(pid, sym);
+    if (spill.index[i].sym == 0) { return; }
+    _varspill_kill(&spill.index[i]);
+    _varspill_remove_at(i);
+}
+
+// Forget the spilled variables of every PID with (pid & mask) == match
+void varspill_drop_pids(int mask, int match) {
+    if (spill.n == 0) { return; }
+    for (size_t i = 0; i < spill.size; i++) {
+        struct VarSpillEntry *e = &spill.index[i];
+        if (e->sym != 0 && (e->pid & mask) == match) {
+            _varspill_kill(e);
+            e->sym = 0;
+            spill.n--;
+        }
+    }
+    _varspill_rehash(spill.size);
+}
+
+// Give a forked process copies of its parent's spilled variables
+void varspill_fork(int parent, int child) {
+    if (spill.n == 0) { return; }
+
+    // Inserting moves entries, so work from a copy of the parent's
+    size_t n = 0;
+    struct VarSpillEntry *parents = malloc(spill.n * sizeof(*parents));
+    for (size_t i = 0; parents != NULL && i < spill.size; i++) {
+        if (spill.index[i].sym != 0 && spill.index[i].pid == parent) { parents[n++] = spill.index[i]; }
+    }
+    for (size_t i = 0; i < n; i++) {
+        const char *value = _varspill_read(&parents[i], NULL);
+        struct VarSpillEntry e = _varspill_append(spill.fd, &spill.end, child, parents[i].sym, value, strlen(value));
+        if (e.len != 0) { _varspill_insert(e); }
+    }
+    free(parents);
+}
+
+// Iterate over a process's spilled variables: start with *i = 0, return 0
+// when done. The strings are valid until the next call.
+int varspill_next(int pid, size_t *i, const char **var, const char **value) {
+    for (; *i < spill.size; (*i)++) {
+        if (spill.index[*i].sym != 0 && spill.index[*i].pid == pid) {
+            *value = _varspill_read(&spill.index[*i], var);
+            (*i)++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Variables spilled now
+size_t varspill_count() {
+    return spill.n;
+}
+
+void varspill_print_stats() {
+    output_printf("varspill: %zu spilled, %lu spills, %lu faults, %lu compactions, %llu bytes live, %llu dead\n",
+        spill.n, spill.spills, spill.faults, spill.compactions,
+        (unsigned long long) spill.live_bytes, (unsigned long long) spill.dead_bytes);
+}
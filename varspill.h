@@ -0,0 +1,44 @@
+/*
+ *  Variable spill tier.
+ *  Variables evicted from the resident store are appended to a spill file
+ *  and found again through an in-memory index by (PID, symbol), so a process
+ *  may have more variables than the store has slots. A record is marked dead
+ *  in place when its variable is faulted back in, set again or dropped; the
+ *  file is rewritten with only live records once dead ones dominate.
+ *
+ *  The file is an unlinked temporary one, or FILE.spill beside a --varstore
+ *  FILE, in which case top-level variables spilled there survive restarts
+ *  along with the resident ones.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "symtab.h"
+
+#define VARSPILL_MAGIC "MYSHSPL1"
+#define VARSPILL_LIVE 0x4556494cu       // "LIVE"
+#define VARSPILL_INDEX_INITIAL 64       // index entries (power of two)
+#define VARSPILL_COMPACT_MIN (64 * 1024) // dead bytes before the file is rewritten
+
+// Record header, followed by the name and the value (without terminators)
+struct VarSpillRecord {
+    uint32_t live;                  // VARSPILL_LIVE, or 0 once dead
+    int32_t pid;
+    uint32_t var_len;
+    uint32_t value_len;
+};
+
+int varspill_open(const char *path);
+void varspill_close();
+int varspill_put(int pid, sym_t sym, const char *value);
+const char *varspill_take(int pid, sym_t sym);
+const char *varspill_get(int pid, sym_t sym);
+void varspill_drop(int pid, sym_t sym);
+void varspill_drop_pids(int mask, int match);
+void varspill_fork(int parent, int child);
+int varspill_next(int pid, size_t *i, const char **var, const char **value);
+size_t varspill_count();
+void varspill_print_stats();
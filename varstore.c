@@ -1,20 +1,50 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "limits.h"
 #include "varstore.h"
 #include "scheduler.h"
+#include "symtab.h"
+#include "probes.h"
+#include "varspill.h"
+#include "output.h"
 
-#define VAR_NULL "none"
+#define LAG_NONE -1                 // the inactive table matches the current one
+#define LAG_ALL -2                  // the inactive table must be copied whole
 
-struct var_memory_struct {
-    int pid;
-    char *var;
-    char *value;
+struct {
+    char *path;                     // backing file, NULL for an in-memory store
+    int fd;
+    struct VarStoreImage *image;
+    int header;                     // current header
+    int lag;                        // slot the inactive table is missing, or LAG_*
+
+    // Open update
+    int changed;                    // slot changed so far, or LAG_*
+    uint32_t heap_used;
+
+    sym_t syms[MEM_SIZE];           // interned name of each slot (slots keep their index across compaction)
+    unsigned char referenced[MEM_SIZE];  // CLOCK reference bits
+    int hand;                       // next slot CLOCK considers
+} store = {
+    .fd = -1,
 };
 
-struct var_memory_struct varstore[MEM_SIZE];
+// Where each variable of a process lives: slot index + 1 by symbol ID, 0 if
+// not known yet, VARSTORE_ABSENT if the process has no such variable
+struct VarSlots {
+    int pid;                        // -1 if the entry is unused
+    sym_t n;                        // length of slot
+    uint32_t *slot;
+} pid_slots[VARSTORE_PID_SLOTS] = {
+    [0 ... VARSTORE_PID_SLOTS - 1] = { .pid = -1 },
+};
 
 // Helper functions
 int match(char *model, char *var) {
@@ -27,54 +57,506 @@ int match(char *model, char *var) {
     } else return 0;
 }
 
-// Shell memory functions
+// FNV-1a over a header, without its checksum
+uint32_t _varstore_checksum(struct VarStoreHeader *h) {
+    uint32_t hash = 2166136261u;
+    const unsigned char *p = (const unsigned char *) h;
+    for (size_t i = 0; i < offsetof(struct VarStoreHeader, checksum); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
 
-void mem_init(){
-    int i;
-    for (i = 0; i < MEM_SIZE; i++){		
-        varstore[i].var   = VAR_NULL;
-        varstore[i].value = VAR_NULL;
+int _varstore_header_valid(struct VarStoreHeader *h) {
+    return memcmp(h->magic, VARSTORE_MAGIC, sizeof(h->magic)) == 0
+        && h->mem_size == MEM_SIZE && h->heap_bytes == VARSTORE_HEAP_BYTES
+        && h->table < 2 && h->heap_used > 0 && h->heap_used <= VARSTORE_HEAP_BYTES
+        && h->checksum == _varstore_checksum(h);
+}
+
+struct VarStoreHeader *_varstore_current() {
+    return &store.image->headers[store.header];
+}
+
+// Committed slot table
+struct VarStoreSlot *_varstore_table() {
+    return store.image->tables[_varstore_current()->table];
+}
+
+char *_varstore_str(uint32_t offset) {
+    return &store.image->heap[offset];
+}
+
+// Write header `i` of an image and make it current
+void _varstore_publish(struct VarStoreImage *image, int i, uint64_t generation, uint32_t table, uint32_t heap_used) {
+    struct VarStoreHeader h = {
+        .generation = generation,
+        .mem_size = MEM_SIZE,
+        .heap_bytes = VARSTORE_HEAP_BYTES,
+        .table = table,
+        .heap_used = heap_used,
+    };
+    memcpy(h.magic, VARSTORE_MAGIC, sizeof(h.magic));
+    h.checksum = _varstore_checksum(&h);
+
+    // Everything the header points at must be in place before it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    image->headers[i] = h;
+}
+
+// Start an update. Return the slot table to modify (the one not in use).
+struct VarStoreSlot *_varstore_begin() {
+    struct VarStoreSlot *current = _varstore_table();
+    struct VarStoreSlot *next = store.image->tables[1 - _varstore_current()->table];
+    if (store.lag == LAG_ALL) {
+        memcpy(next, current, sizeof(store.image->tables[0]));
+    } else if (store.lag >= 0) {
+        next[store.lag] = current[store.lag];
     }
+    store.changed = LAG_NONE;
+    store.heap_used = _varstore_current()->heap_used;
+    return next;
 }
 
-// Set key value pair
-void mem_set_value(char *var_in, char *value_in) {
-    int i;
+// Note a slot modified by the open update
+void _varstore_touch(int slot) {
+    store.changed = store.changed == LAG_NONE || store.changed == slot ? slot : LAG_ALL;
+}
 
-    for (i = 0; i < MEM_SIZE; i++){
-        if (
-            varstore[i].pid == getspid() &&
-            strcmp(varstore[i].var, var_in) == 0
-        ) {
-            varstore[i].value = strdup(value_in);
+// Copy a string to the heap for the open update. Return its offset, 0 if full.
+uint32_t _varstore_append(const char *s) {
+    size_t len = strlen(s) + 1;
+    if (store.heap_used + len > VARSTORE_HEAP_BYTES) { return 0; }
+    uint32_t offset = store.heap_used;
+    memcpy(_varstore_str(offset), s, len);
+    store.heap_used += len;
+    return offset;
+}
+
+// Write a range of a file-backed image back to the file
+void _varstore_sync(const void *p, size_t len) {
+    if (len == 0) { return; }
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) p & ~(page - 1);
+    msync((void *) start, (uintptr_t) p + len - start, MS_SYNC);
+}
+
+// Publish the open update by overwriting the older header. In a file, the
+// slot table and the new strings reach the disk first, so that the header
+// never points at unwritten data after an OS crash or power loss.
+void _varstore_commit() {
+    struct VarStoreHeader *current = _varstore_current();
+    int next = 1 - store.header;
+    if (store.fd >= 0) {
+        _varstore_sync(store.image->tables[1 - current->table], sizeof(store.image->tables[0]));
+        _varstore_sync(_varstore_str(current->heap_used), store.heap_used - current->heap_used);
+    }
+    _varstore_publish(store.image, next, current->generation + 1, 1 - current->table, store.heap_used);
+    store.header = next;
+    store.lag = store.changed;
+}
+
+// Map the backing file, or allocate an in-memory image
+struct VarStoreImage *_varstore_map(int fd) {
+    if (fd < 0) { return calloc(1, sizeof(struct VarStoreImage)); }
+    void *p = mmap(NULL, sizeof(struct VarStoreImage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void _varstore_unmap(struct VarStoreImage *image, int fd) {
+    if (fd < 0) {
+        free(image);
+    } else {
+        munmap(image, sizeof(struct VarStoreImage));
+        close(fd);
+    }
+}
+
+// Rebuild the store with only live strings in its heap
+void _varstore_compact() {
+    int fd = -1;
+    char tmp[4096];
+    if (store.path != NULL) {
+        snprintf(tmp, sizeof(tmp), "%s.tmp", store.path);
+        fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) { return; }
+        if (ftruncate(fd, sizeof(struct VarStoreImage)) != 0) {
+            close(fd);
+            remove(tmp);
             return;
         }
     }
+    struct VarStoreImage *image = _varstore_map(fd);
+    if (image == NULL) {
+        if (fd >= 0) { close(fd); remove(tmp); }
+        return;
+    }
+
+    // Copy the live variables
+    struct VarStoreSlot *table = _varstore_table();
+    uint32_t used = 1;  // offset 0 means "free"
+    for (int i = 0; i < MEM_SIZE; i++) {
+        if (table[i].var == 0) { continue; }
+        uint32_t offsets[2] = { table[i].var, table[i].value };
+        for (int j = 0; j < 2; j++) {
+            size_t len = strlen(_varstore_str(offsets[j])) + 1;
+            if (used + len > VARSTORE_HEAP_BYTES) {  // shared strings no longer fit once copied
+                _varstore_unmap(image, fd);
+                if (fd >= 0) { remove(tmp); }
+                return;
+            }
+            memcpy(&image->heap[used], _varstore_str(offsets[j]), len);
+            offsets[j] = used;
+            used += len;
+        }
+        image->tables[0][i] = (struct VarStoreSlot) { .pid = table[i].pid, .var = offsets[0], .value = offsets[1] };
+    }
+    _varstore_publish(image, 0, _varstore_current()->generation + 1, 0, used);
+
+    // Swap the new image in
+    if (fd >= 0 && (msync(image, sizeof(struct VarStoreImage), MS_SYNC) != 0 || rename(tmp, store.path) != 0)) {
+        _varstore_unmap(image, fd);
+        remove(tmp);
+        return;
+    }
+    _varstore_unmap(store.image, store.fd);
+    store.image = image;
+    store.fd = fd;
+    store.header = 0;
+    store.lag = LAG_ALL;
+}
+
+// 1 if `need` more heap bytes fit without compaction
+int _varstore_fits(size_t need) {
+    return _varstore_current()->heap_used + need <= VARSTORE_HEAP_BYTES;
+}
 
-    // Value does not exist, need to find a free spot.
+// Open the backing file, creating an empty store in it if it is new
+int _varstore_open_file() {
+    store.fd = open(store.path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (store.fd < 0 || fstat(store.fd, &st) != 0) {
+        fprintf(stderr, "varstore: could not open '%s'\n", store.path);
+        return 1;
+    }
+    int fresh = st.st_size == 0;
+    if (fresh && ftruncate(store.fd, sizeof(struct VarStoreImage)) != 0) {
+        fprintf(stderr, "varstore: could not size '%s'\n", store.path);
+        return 1;
+    }
+    if (!fresh && st.st_size != sizeof(struct VarStoreImage)) {
+        fprintf(stderr, "varstore: '%s' was made by a build with a different store size\n", store.path);
+        return 1;
+    }
+    store.image = _varstore_map(store.fd);
+    if (store.image == NULL) {
+        fprintf(stderr, "varstore: could not map '%s'\n", store.path);
+        return 1;
+    }
+    if (fresh) { _varstore_publish(store.image, 0, 1, 0, 1); }
+
+    // Take the newest valid header
+    struct VarStoreHeader *h = store.image->headers;
+    int valid[2] = { _varstore_header_valid(&h[0]), _varstore_header_valid(&h[1]) };
+    if (!valid[0] && !valid[1]) {
+        fprintf(stderr, "varstore: '%s' is not a variable store\n", store.path);
+        return 1;
+    }
+    store.header = !valid[0] || (valid[1] && h[1].generation > h[0].generation);
+    return 0;
+}
+
+// Slot array of a process, taking over its cache entry if another process has it
+struct VarSlots *_varstore_slots(int pid, sym_t sym) {
+    struct VarSlots *s = &pid_slots[((uint32_t) pid * 2654435761u) >> 24 & (VARSTORE_PID_SLOTS - 1)];
+    if (s->pid != pid) {
+        if (s->slot != NULL) { memset(s->slot, 0, s->n * sizeof(*s->slot)); }
+        s->pid = pid;
+    }
+    if (sym >= s->n) {
+        sym_t n = symtab_count() > sym ? symtab_count() : sym + 1;
+        s->slot = realloc(s->slot, n * sizeof(*s->slot));
+        memset(s->slot + s->n, 0, (n - s->n) * sizeof(*s->slot));
+        s->n = n;
+    }
+    return s;
+}
+
+// Forget what is known about a process's slots
+void _varstore_forget(int pid) {
+    for (int i = 0; i < VARSTORE_PID_SLOTS; i++) {
+        if (pid_slots[i].pid == pid) { pid_slots[i].pid = -1; }
+    }
+}
+
+// Find the slot of a variable, -1 if the process does not have it
+int _varstore_find(int pid, sym_t sym) {
+    struct VarStoreSlot *table = _varstore_table();
+    struct VarSlots *s = _varstore_slots(pid, sym);
+    uint32_t known = s->slot[sym];
+    if (known == VARSTORE_ABSENT) { return -1; }
+    if (known != 0) {
+        int i = known - 1;
+        if (table[i].var != 0 && table[i].pid == pid && store.syms[i] == sym) {
+            store.referenced[i] = 1;
+            return i;
+        }
+    }
+
+    // Not cached, or the slot was dropped since
+    for (int i = 0; i < MEM_SIZE; i++) {
+        if (table[i].var != 0 && table[i].pid == pid && store.syms[i] == sym) {
+            s->slot[sym] = i + 1;
+            store.referenced[i] = 1;
+            return i;
+        }
+    }
+    s->slot[sym] = VARSTORE_ABSENT;
+    return -1;
+}
+
+// Slot for a new variable: a free one, or the one CLOCK picks to spill
+int _varstore_victim() {
+    struct VarStoreSlot *table = _varstore_table();
+    for (;;) {
+        int i = store.hand;
+        store.hand = (store.hand + 1) % MEM_SIZE;
+        if (table[i].var == 0 || !store.referenced[i]) { return i; }
+        store.referenced[i] = 0;
+    }
+}
+
+// Make room for `need` more heap bytes: compact, and if that is not enough,
+// spill the variables CLOCK picks (never slot `keep`) and compact again.
+// Return 0 if there is room.
+int _varstore_reserve(size_t need, int keep) {
+    if (_varstore_fits(need)) { return 0; }
+    _varstore_compact();
+    if (_varstore_fits(need)) { return 0; }
+
+    // Spill until the strings given up cover the shortfall
+    size_t shortfall = _varstore_current()->heap_used + need - VARSTORE_HEAP_BYTES;
+    size_t freed = 0;
+    struct VarStoreSlot *current = _varstore_table();
+    struct VarStoreSlot *table = _varstore_begin();
+    for (int n = 0; n < 2 * MEM_SIZE && freed < shortfall; n++) {
+        int i = _varstore_victim();
+        if (i == keep || current[i].var == 0) { continue; }
+        const char *value = _varstore_str(current[i].value);
+        if (varspill_put(current[i].pid, store.syms[i], value)) { break; }
+        freed += strlen(_varstore_str(current[i].var)) + strlen(value) + 2;
+        table[i] = (struct VarStoreSlot) { 0 };
+        _varstore_touch(i);
+    }
+    if (store.changed != LAG_NONE) { _varstore_commit(); }
+    _varstore_compact();
+    return !_varstore_fits(need);
+}
+
+// Store a variable's value in its slot `i`, or, with i = -1, in a new slot
+// (spilling the variable CLOCK picks if every slot is taken). A value the heap
+// cannot make room for goes straight to the spill tier. Return the slot, -1
+// if the value is not resident.
+int _varstore_store(int pid, sym_t sym, const char *value, int i) {
+    const char *var = symtab_name(sym);
+    size_t need = strlen(value) + 1 + (i < 0 ? strlen(var) + 1 : 0);
+    char *copy = NULL;
+    if (!_varstore_fits(need)) {
+        // Making room spills variables, which reuses the spill tier's buffer
+        // `value` may be in
+        value = copy = strdup(value);
+        if (_varstore_reserve(need, i)) {
+            if (i >= 0) {
+                struct VarStoreSlot *table = _varstore_begin();
+                table[i] = (struct VarStoreSlot) { 0 };
+                _varstore_touch(i);
+                _varstore_commit();
+            }
+            if (varspill_put(pid, sym, value)) { output_printf("varstore: no room to set %s\n", var); }
+            free(copy);
+            return -1;
+        }
+    }
+
+    // Copy the strings first: `value` may be the spill tier's buffer
+    struct VarStoreSlot *current = _varstore_table();
+    struct VarStoreSlot *table = _varstore_begin();
+    uint32_t value_offset = _varstore_append(value);
+    free(copy);
+    if (i >= 0) {
+        table[i].value = value_offset;
+    } else {
+        uint32_t var_offset = _varstore_append(var);
+        i = _varstore_victim();
+        if (current[i].var != 0 && varspill_put(current[i].pid, store.syms[i], _varstore_str(current[i].value))) {
+            output_printf("varstore: no room to set %s\n", var);
+            return -1;  // the open update is abandoned
+        }
+        table[i] = (struct VarStoreSlot) { .pid = pid, .var = var_offset, .value = value_offset };
+        store.syms[i] = sym;
+        _varstore_slots(pid, sym)->slot[sym] = i + 1;
+    }
+    store.referenced[i] = 1;
+    _varstore_touch(i);
+    _varstore_commit();
+    return i;
+}
+
+// Find the slot of a variable, faulting it back in if it was spilled. Return
+// -1 if the process does not have it resident (it may still be spilled).
+int _varstore_fault(int pid, sym_t sym) {
+    int i = _varstore_find(pid, sym);
+    if (i >= 0) { return i; }
+    const char *value = varspill_take(pid, sym);
+    if (value == NULL) { return -1; }
+    return _varstore_store(pid, sym, value, -1);
+}
+
+// Shell memory functions
+
+// Back the store with a file (before mem_init)
+void mem_set_file(const char *path) {
+    store.path = strdup(path);
+}
+
+// Set up the store. Variables of processes from an earlier session are
+// dropped; top-level ones are kept. Return 0 on success.
+int mem_init(){
+    int i;
+    store.lag = LAG_ALL;
+    if (store.path == NULL) {
+        store.image = _varstore_map(-1);
+        _varstore_publish(store.image, 0, 1, 0, 1);
+        store.header = 0;
+        return varspill_open(NULL);
+    }
+    if (_varstore_open_file()) { return 1; }
+
+    uint32_t used = _varstore_current()->heap_used;
+    struct VarStoreSlot *table = _varstore_begin();
     for (i = 0; i < MEM_SIZE; i++){
-        if (strcmp(varstore[i].var, VAR_NULL) == 0) {
-            varstore[i].pid   = getspid();
-            varstore[i].var   = strdup(var_in);
-            varstore[i].value = strdup(value_in);
-            return;
-        } 
+        if (table[i].var == 0) { continue; }
+        if (table[i].pid != 0 || table[i].var >= used || table[i].value >= used) {
+            table[i] = (struct VarStoreSlot) { 0 };
+            _varstore_touch(i);
+        } else {
+            store.syms[i] = symtab_intern(_varstore_str(table[i].var), strlen(_varstore_str(table[i].var)));
+        }
     }
+    if (store.changed != LAG_NONE) { _varstore_commit(); }
 
-    return;
+    // Spilled top-level variables are kept beside the file (a resident copy
+    // is the newer one)
+    char spill_path[4096];
+    snprintf(spill_path, sizeof(spill_path), "%s.spill", store.path);
+    if (varspill_open(spill_path)) { return 1; }
+    table = _varstore_table();
+    for (i = 0; i < MEM_SIZE; i++) {
+        if (table[i].var != 0) { varspill_drop(table[i].pid, store.syms[i]); }
+    }
+    return 0;
 }
 
-//get value based on input key
-char *mem_get_value(char *var_in) {
+// Drop the variables of every PID with (pid & mask) == match
+void mem_drop_pids(int mask, int match) {
     int i;
+    struct VarStoreSlot *table = _varstore_begin();
+    for (i = 0; i < MEM_SIZE; i++){
+        if (table[i].var != 0 && (table[i].pid & mask) == match) {
+            table[i] = (struct VarStoreSlot) { 0 };
+            _varstore_touch(i);
+        }
+    }
+    if (store.changed != LAG_NONE) { _varstore_commit(); }
+    varspill_drop_pids(mask, match);
+}
+
+// Flush the backing file
+void mem_close() {
+    if (store.fd >= 0) { msync(store.image, sizeof(struct VarStoreImage), MS_SYNC); }
+    varspill_close();
+}
+
+// Set key value pair
+void mem_set_value(const char *var_in, const char *value_in) {
+    mem_set_value_pid(getspid(), var_in, value_in);
+}
+
+// Set key value pair for a given process
+void mem_set_value_pid(int pid, const char *var_in, const char *value_in) {
+    mem_set_sym_pid(pid, symtab_intern(var_in, strlen(var_in)), value_in);
+}
+
+// Set a variable of a given process by symbol
+void mem_set_sym_pid(int pid, sym_t sym, const char *value_in) {
+    MYSH_PROBE3(var_set, pid, symtab_name(sym), value_in);
+    int i = _varstore_find(pid, sym);
+    if (i < 0) { varspill_drop(pid, sym); }    // not resident: a spilled value is stale now
+    _varstore_store(pid, sym, value_in, i);
+}
+
+// Get the value of a variable of the running process, NULL if it is not set.
+// The string stays valid until the store is next updated.
+const char *mem_get_value(const char *var_in) {
+    sym_t sym = symtab_find(var_in, strlen(var_in));
+    return sym == 0 ? NULL : mem_get_sym(sym);
+}
+
+// Get a variable by symbol
+const char *mem_get_sym(sym_t sym) {
+    int pid = getspid();
+    int i = _varstore_fault(pid, sym);
+    const char *value = i >= 0 ? _varstore_str(_varstore_table()[i].value) : varspill_get(pid, sym);
+    MYSH_PROBE3(var_get, pid, symtab_name(sym), value);
+    return value;
+}
+
+// Give a forked process a copy of its parent's variables (the strings are shared)
+void mem_fork(int parent, int child) {
+    int i, j = 0;
 
+    struct VarStoreSlot *current = _varstore_table();
+    struct VarStoreSlot *table = _varstore_begin();
     for (i = 0; i < MEM_SIZE; i++){
-        if (
-            varstore[i].pid == getspid() &&
-            strcmp(varstore[i].var, var_in) == 0
-        ) {
-            return strdup(varstore[i].value);
-        } 
-    }
-    return NULL;  // variable does not exist
+        if (current[i].var == 0 || current[i].pid != parent) { continue; }
+
+        // Find a free spot for the copy, or spill it
+        while (j < MEM_SIZE && table[j].var != 0) { j++; }
+        if (j == MEM_SIZE) {
+            varspill_put(child, store.syms[i], _varstore_str(current[i].value));
+            continue;
+        }
+        table[j] = (struct VarStoreSlot) { .pid = child, .var = current[i].var, .value = current[i].value };
+        store.syms[j] = store.syms[i];
+        _varstore_touch(j);
+    }
+    _varstore_commit();
+    varspill_fork(parent, child);
+    _varstore_forget(child);
+}
+
+// Iterate over a process's variables, resident then spilled: start with
+// *i = 0, return 0 when done
+int mem_next_var(int pid, int *i, char **var, char **value) {
+    struct VarStoreSlot *table = _varstore_table();
+    for (; *i < MEM_SIZE; (*i)++){
+        if (table[*i].var != 0 && table[*i].pid == pid) {
+            *var = _varstore_str(table[*i].var);
+            *value = _varstore_str(table[*i].value);
+            (*i)++;
+            return 1;
+        }
+    }
+    size_t j = *i - MEM_SIZE;
+    int found = varspill_next(pid, &j, (const char **) var, (const char **) value);
+    *i = MEM_SIZE + j;
+    return found;
+}
+
+void mem_print_stats() {
+    int resident = 0;
+    struct VarStoreSlot *table = _varstore_table();
+    for (int i = 0; i < MEM_SIZE; i++) { resident += table[i].var != 0; }
+    output_printf("varstore: %d/%d slots resident\n", resident, MEM_SIZE);
+    varspill_print_stats();
 }
@@ -1,3 +1,66 @@
-void mem_init();
-char *mem_get_value(char *var);
-void mem_set_value(char *var, char *value);
+/*
+ *  Variable store.
+ *  The store is one pointer-free image: two headers, two slot tables and an
+ *  append-only string heap, all addressed by offset. It lives in memory, or in
+ *  a mapped file (--varstore FILE) so that top-level variables survive restarts.
+ *
+ *  Updates are crash consistent: new strings are appended past the committed
+ *  end of the heap, the slot table not in use is brought up to date, and then
+ *  the older header is overwritten to point at it with the next generation.
+ *  In a file, the table and strings are synced to disk before the header is
+ *  written, so this holds across OS crashes as well as process crashes.
+ *  Loading takes the valid header with the highest generation. When the heap
+ *  fills, live strings are compacted into a fresh image (written beside the
+ *  file and renamed over it).
+ *
+ *  When every slot is taken, a new variable takes the slot CLOCK picks, and
+ *  the variable there is spilled (see varspill.h) until it is used again.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "limits.h"
+#include "symtab.h"
+
+#define VARSTORE_MAGIC "MYSHVAR1"
+#define VARSTORE_PAIR_MAX (2 * MAX_USER_INPUT + 2)     // a full-length name and value with terminators
+#define VARSTORE_HEAP_BYTES ((MEM_SIZE + 1) * VARSTORE_PAIR_MAX)  // every slot, and the pair being set
+#define VARSTORE_PID_SLOTS 16       // processes with a cached slot array (power of two)
+#define VARSTORE_ABSENT UINT32_MAX
+
+struct VarStoreHeader {
+    char magic[sizeof(VARSTORE_MAGIC) - 1];
+    uint64_t generation;            // the valid header with the highest generation is current
+    uint32_t mem_size;              // geometry of the build that made the image
+    uint32_t heap_bytes;
+    uint32_t table;                 // slot table in use (0 or 1)
+    uint32_t heap_used;             // committed end of the heap
+    uint32_t checksum;              // of the fields above
+};
+
+struct VarStoreSlot {
+    int32_t pid;
+    uint32_t var;                   // heap offsets of NUL-terminated strings, 0 if the slot is free
+    uint32_t value;
+};
+
+struct VarStoreImage {
+    struct VarStoreHeader headers[2];
+    struct VarStoreSlot tables[2][MEM_SIZE];
+    char heap[VARSTORE_HEAP_BYTES];
+};
+
+void mem_set_file(const char *path);
+int mem_init();
+void mem_close();
+const char *mem_get_value(const char *var);
+const char *mem_get_sym(sym_t sym);
+void mem_set_value(const char *var, const char *value);
+void mem_set_value_pid(int pid, const char *var, const char *value);
+void mem_set_sym_pid(int pid, sym_t sym, const char *value);
+int mem_next_var(int pid, int *i, char **var, char **value);
+void mem_fork(int parent, int child);
+void mem_drop_pids(int mask, int match);
+void mem_print_stats();
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "vtime.h"
+#include "output.h"
+
+struct {
+    int enabled;
+    uint64_t insn_ticks;
+    struct VtimeLatency latency[2];     // by request kind
+    uint64_t rng;                       // splitmix64 state
+
+    vtime_t now;
+    vtime_t disk_free_at;               // the disk is busy until then
+    vtime_t io_done;                    // completion of the requests since vtime_io_begin()
+
+    unsigned long lines;
+    unsigned long requests[2];
+    vtime_t disk_busy;
+    vtime_t idle;
+    unsigned long finished;
+    vtime_t turnaround;
+} vtime = {
+    .insn_ticks = VTIME_INSN_TICKS,
+    .latency = {
+        [VTIME_REQ_PAGE_IN] = { VTIME_FIXED, VTIME_PAGE_IN_TICKS, 0 },
+        [VTIME_REQ_EVICT] = { VTIME_FIXED, VTIME_EVICT_TICKS, 0 },
+    },
+    .rng = VTIME_SEED,
+};
+
+void vtime_set_enabled(int enabled) {
+    vtime.enabled = enabled;
+}
+
+int vtime_enabled() {
+    return vtime.enabled;
+}
+
+// Parse a latency distribution: fixed:N, uniform:LO-HI or exp:MEAN (ticks).
+// Return 1 if the spec is not valid.
+int vtime_set_latency(enum VtimeRequest req, const char *spec) {
+    struct VtimeLatency l = { 0 };
+    unsigned long long a, b;
+    char end;
+    if (sscanf(spec, "fixed:%llu%c", &a, &end) == 1) {
+        l = (struct VtimeLatency) { VTIME_FIXED, a, 0 };
+    } else if (sscanf(spec, "uniform:%llu-%llu%c", &a, &b, &end) == 2 && a <= b) {
+        l = (struct VtimeLatency) { VTIME_UNIFORM, a, b };
+    } else if (sscanf(spec, "exp:%llu%c", &a, &end) == 1) {
+        l = (struct VtimeLatency) { VTIME_EXP, a, 0 };
+    } else {
+        return 1;
+    }
+    vtime.latency[req] = l;
+    return 0;
+}
+
+void vtime_set_insn_ticks(uint64_t ticks) {
+    vtime.insn_ticks = ticks;
+}
+
+void vtime_set_seed(uint64_t seed) {
+    vtime.rng = seed;
+}
+
+uint64_t _vtime_random() {
+    uint64_t z = (vtime.rng += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+uint64_t _vtime_draw(struct VtimeLatency *l) {
+    switch (l->dist) {
+        case VTIME_UNIFORM:
+            return l->a + _vtime_random() % (l->b - l->a + 1);
+        case VTIME_EXP: {
+            double u = (_vtime_random() >> 11) * (1.0 / 9007199254740992.0);   // [0, 1)
+            return (uint64_t) llround(-log1p(-u) * (double) l->a);
+        }
+        default:
+            return l->a;
+    }
+}
+
+vtime_t vtime_now() {
+    return vtime.now;
+}
+
+// A line was executed
+void vtime_instruction() {
+    if (!vtime.enabled) { return; }
+    vtime.now += vtime.insn_ticks;
+    vtime.lines++;
+}
+
+// Start collecting the disk requests a process will wait for
+void vtime_io_begin() {
+    vtime.io_done = vtime.now;
+}
+
+// Queue a request on the disk. It starts when the disk is free.
+void vtime_disk_request(enum VtimeRequest req) {
+    if (!vtime.enabled) { return; }
+    uint64_t latency = _vtime_draw(&vtime.latency[req]);
+    vtime_t start = vtime.disk_free_at > vtime.now ? vtime.disk_free_at : vtime.now;
+    vtime.disk_free_at = start + latency;
+    vtime.io_done = vtime.disk_free_at;
+    vtime.disk_busy += latency;
+    vtime.requests[req]++;
+}
+
+// When the requests since vtime_io_begin() complete
+vtime_t vtime_io_done() {
+    return vtime.io_done;
+}
+
+// Every process is waiting: jump to the next completion
+void vtime_idle_until(vtime_t t) {
+    if (t <= vtime.now) { return; }
+    vtime.idle += t - vtime.now;
+    vtime.now = t;
+}
+
+void vtime_process_done(vtime_t started_at) {
+    if (!vtime.enabled) { return; }
+    vtime.finished++;
+    vtime.turnaround += vtime.now - started_at;
+}
+
+void vtime_print_stats() {
+    if (!vtime.enabled) {
+        output_printf("vtime: off\n");
+        return;
+    }
+    output_printf("vtime: %llu ticks, %lu lines, %lu page-ins, %lu evictions, disk busy %llu, idle %llu, "
+        "%lu finished (mean turnaround %llu)\n",
+        (unsigned long long) vtime.now, vtime.lines, vtime.requests[VTIME_REQ_PAGE_IN], vtime.requests[VTIME_REQ_EVICT],
+        (unsigned long long) vtime.disk_busy, (unsigned long long) vtime.idle, vtime.finished,
+        (unsigned long long) (vtime.finished ? vtime.turnaround / vtime.finished : 0));
+}
@@ -0,0 +1,53 @@
+/*
+ *  Virtual time for deterministic paging experiments.
+ *  With --vtime, the shell keeps its own clock instead of paying host I/O
+ *  costs: each executed line costs a fixed number of ticks, and each page-in
+ *  or eviction is a request to one simulated disk. The disk serves requests in
+ *  order, each taking a latency drawn from a seeded distribution, so reruns
+ *  with the same seed are bit-identical. A faulting process waits for its
+ *  requests to complete while others run; when every process is waiting the
+ *  clock jumps to the next completion.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define VTIME_INSN_TICKS 1          // default cost of a line
+#define VTIME_PAGE_IN_TICKS 1000    // default latencies
+#define VTIME_EVICT_TICKS 0         // code pages are clean: nothing to write back by default
+#define VTIME_SEED 1
+
+typedef uint64_t vtime_t;
+
+enum VtimeDist {
+    VTIME_FIXED,                    // a
+    VTIME_UNIFORM,                  // a..b inclusive
+    VTIME_EXP,                      // exponential with mean a
+};
+
+struct VtimeLatency {
+    enum VtimeDist dist;
+    uint64_t a;
+    uint64_t b;
+};
+
+enum VtimeRequest {
+    VTIME_REQ_PAGE_IN,
+    VTIME_REQ_EVICT,
+};
+
+void vtime_set_enabled(int enabled);
+int vtime_enabled();
+int vtime_set_latency(enum VtimeRequest req, const char *spec);
+void vtime_set_insn_ticks(uint64_t ticks);
+void vtime_set_seed(uint64_t seed);
+
+vtime_t vtime_now();
+void vtime_instruction();
+void vtime_io_begin();
+void vtime_disk_request(enum VtimeRequest req);
+vtime_t vtime_io_done();
+void vtime_idle_until(vtime_t t);
+void vtime_process_done(vtime_t started_at);
+void vtime_print_stats();
@@ -0,0 +1,31 @@
+#include "workingset.h"
+
+// One instruction was executed on `page`
+void ws_reference(struct WorkingSet *ws, page_num_t page) {
+    ws->clock++;
+    if (page >= 0 && page < PAGE_TBL_SIZE) { ws->last_ref[page] = ws->clock; }
+}
+
+// The process faulted at the current instruction
+void ws_fault(struct WorkingSet *ws) {
+    ws->fault_times[ws->n_faults++ % WS_FAULT_HISTORY] = ws->clock;
+}
+
+// Pages referenced in the last WS_WINDOW instructions
+int ws_size(struct WorkingSet *ws) {
+    int n = 0;
+    for (int i = 0; i < PAGE_TBL_SIZE; i++) {
+        n += ws->last_ref[i] != 0 && ws->clock - ws->last_ref[i] < WS_WINDOW;
+    }
+    return n;
+}
+
+// Faults in the last WS_WINDOW instructions
+int ws_fault_frequency(struct WorkingSet *ws) {
+    int n = 0;
+    uint32_t held = ws->n_faults < WS_FAULT_HISTORY ? ws->n_faults : WS_FAULT_HISTORY;
+    for (uint32_t i = 0; i < held; i++) {
+        n += ws->clock - ws->fault_times[i] < WS_WINDOW;
+    }
+    return n;
+}
@@ -0,0 +1,28 @@
+/*
+ *  Per-process working set and page fault frequency estimates.
+ *  Time is the process's own instruction count: the working set is the set of
+ *  pages referenced in the last WS_WINDOW instructions, and the fault
+ *  frequency is the number of faults in that same window.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "utiltypes.h"
+
+#define WS_WINDOW 12                // instructions (four pages of straight-line code)
+#define WS_FAULT_HISTORY 8          // fault times kept per process
+#define PFF_HIGH 2                  // faults per window that mark a process as faulting heavily
+
+struct WorkingSet {
+    uint32_t clock;                         // instructions executed
+    uint32_t last_ref[PAGE_TBL_SIZE];       // clock at last reference, 0 if never referenced
+    uint32_t fault_times[WS_FAULT_HISTORY];
+    uint32_t n_faults;
+};
+
+void ws_reference(struct WorkingSet *ws, page_num_t page);
+void ws_fault(struct WorkingSet *ws);
+int ws_size(struct WorkingSet *ws);
+int ws_fault_frequency(struct WorkingSet *ws);
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ztier.h"
+#include "output.h"
+
+#define ZTIER_NULL_LINE 0xFF        // length byte of a line past the end of the script
+#define ZTIER_MIN_MATCH 4
+
+// Index entry for one compressed page
+struct ZEntry {
+    unsigned long src_id;           // 0 if the slot was never used
+    page_num_t page;
+    uint64_t pos;                   // arena position (monotonic)
+    uint16_t len;                   // stored bytes
+    uint16_t compressed;            // 0 if stored raw
+};
+
+struct {
+    int enabled;
+    uint64_t head;                  // next arena write position (monotonic)
+    struct ZEntry index[ZTIER_ENTRIES];
+    uint8_t arena[ZTIER_BYTES];
+    // Statistics
+    unsigned long stores, lookups, hits;
+    unsigned long long bytes_in, bytes_out;
+} ztier = { .enabled = 1 };
+
+void ztier_set_enabled(int enabled) {
+    ztier.enabled = enabled;
+}
+
+// LZ77 codec, LZ4-like sequence format:
+//   token (literal count << 4 | match length - 4), extra length bytes,
+//   literals, 2-byte little-endian offset (absent after the last literals)
+
+uint32_t _ztier_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Write an extended length. Return the new output position, or cap + 1 on overflow.
+size_t _ztier_put_length(uint8_t *out, size_t op, size_t cap, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op >= cap) { return cap + 1; }
+        out[op++] = 255;
+    }
+    if (op >= cap) { return cap + 1; }
+    out[op++] = len;
+    return op;
+}
+
+// Emit one sequence. match_len 0 means final literals. Return cap + 1 on overflow.
+size_t _ztier_emit(uint8_t *out, size_t op, size_t cap, const uint8_t *lit, size_t lit_len, size_t offset, size_t match_len) {
+    if (op >= cap) { return cap + 1; }
+    size_t m = match_len ? match_len - ZTIER_MIN_MATCH : 0;
+    out[op++] = (lit_len < 15 ? lit_len : 15) << 4 | (m < 15 ? m : 15);
+    if (lit_len >= 15 && (op = _ztier_put_length(out, op, cap, lit_len - 15)) > cap) { return op; }
+    if (op + lit_len > cap) { return cap + 1; }
+    memcpy(out + op, lit, lit_len);
+    op += lit_len;
+    if (match_len == 0) { return op; }
+    if (op + 2 > cap) { return cap + 1; }
+    out[op++] = offset & 0xFF;
+    out[op++] = offset >> 8;
+    if (m >= 15 && (op = _ztier_put_length(out, op, cap, m - 15)) > cap) { return op; }
+    return op;
+}
+
+// Compress n bytes. Return the compressed size, or 0 if it would not fit in cap.
+size_t ztier_lz_compress(const uint8_t *in, size_t n, uint8_t *out, size_t cap) {
+    int table[1 << ZTIER_LZ_HASH_BITS];
+    memset(table, -1, sizeof(table));
+
+    size_t ip = 0, anchor = 0, op = 0;
+    while (ip + ZTIER_MIN_MATCH <= n) {
+        uint32_t seq = _ztier_read32(in + ip);
+        size_t h = (seq * 2654435761u) >> (32 - ZTIER_LZ_HASH_BITS);
+        int ref = table[h];
+        table[h] = ip;
+        if (ref < 0 || ip - ref > 0xFFFF || _ztier_read32(in + ref) != seq) {
+            ip++;
+            continue;
+        }
+        size_t match_len = ZTIER_MIN_MATCH;
+        while (ip + match_len < n && in[ref + match_len] == in[ip + match_len]) { match_len++; }
+        op = _ztier_emit(out, op, cap, in + anchor, ip - anchor, ip - ref, match_len);
+        if (op > cap) { return 0; }
+        ip += match_len;
+        anchor = ip;
+    }
+    op = _ztier_emit(out, op, cap, in + anchor, n - anchor, 0, 0);
+    return op > cap ? 0 : op;
+}
+
+// Read an extended length. Return -1 if the input ends.
+long _ztier_get_length(const uint8_t *in, size_t n, size_t *ip) {
+    long len = 0;
+    uint8_t b;
+    do {
+        if (*ip >= n) { return -1; }
+        b = in[(*ip)++];
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+// Decompress. Return the decompressed size, or -1 if the input is corrupt.
+long ztier_lz_decompress(const uint8_t *in, size_t n, uint8_t *out, size_t cap) {
+    size_t ip = 0, op = 0;
+    while (ip < n) {
+        uint8_t token = in[ip++];
+        long lit_len = token >> 4;
+        if (lit_len == 15) {
+            long extra = _ztier_get_length(in, n, &ip);
+            if (extra < 0) { return -1; }
+            lit_len += extra;
+        }
+        if (ip + lit_len > n || op + lit_len > cap) { return -1; }
+        memcpy(out + op, in + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == n) { break; }     // final literals
+
+        if (ip + 2 > n) { return -1; }
+        size_t offset = in[ip] | in[ip + 1] << 8;
+        ip += 2;
+        long match_len = token & 0xF;
+        if (match_len == 15) {
+            long extra = _ztier_get_length(in, n, &ip);
+            if (extra < 0) { return -1; }
+            match_len += extra;
+        }
+        match_len += ZTIER_MIN_MATCH;
+        if (offset == 0 || offset > op || op + match_len > cap) { return -1; }
+        for (long i = 0; i < match_len; i++, op++) { out[op] = out[op - offset]; }   // may overlap
+    }
+    return op;
+}
+
+// Page (de)serialization: line count, one length byte per line, then the text
+
+size_t _ztier_serialize(frame_t lines, uint8_t *raw) {
+    size_t n = 0;
+    raw[n++] = FRAME_SIZE;
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        raw[n++] = lines[i].text == NULL ? ZTIER_NULL_LINE : lines[i].len;
+    }
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        if (lines[i].text == NULL) { continue; }
+        memcpy(raw + n, lines[i].text, lines[i].len);
+        n += lines[i].len;
+    }
+    return n;
+}
+
+int _ztier_deserialize(const uint8_t *raw, size_t n, frame_t lines, char (*copy)[CMD_MAX_CHARS]) {
+    if (n < 1 + FRAME_SIZE || raw[0] != FRAME_SIZE) { return 1; }
+    size_t p = 1 + FRAME_SIZE;
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        uint8_t len = raw[1 + i];
+        if (len == ZTIER_NULL_LINE) {
+            lines[i] = (struct LineSpan) { NULL, 0 };
+            continue;
+        }
+        if (len >= CMD_MAX_CHARS || p + len > n) { return 1; }
+        memcpy(copy[i], raw + p, len);
+        copy[i][len] = '\0';
+        lines[i] = (struct LineSpan) { copy[i], len };
+        p += len;
+    }
+    return 0;
+}
+
+// 1 if the entry's bytes have not been overwritten in the arena
+int _ztier_live(struct ZEntry *e) {
+    return e->src_id != 0 && e->pos + ZTIER_BYTES >= ztier.head;
+}
+
+struct ZEntry *_ztier_find(unsigned long src_id, page_num_t page) {
+    size_t home = (src_id * 31 + page) * 2654435761u;
+    for (int i = 0; i < ZTIER_PROBE; i++) {
+        struct ZEntry *e = &ztier.index[(home + i) & (ZTIER_ENTRIES - 1)];
+        if (e->src_id == src_id && e->page == page && _ztier_live(e)) { return e; }
+    }
+    return NULL;
+}
+
+// Slot to store a page in: a dead slot if there is one, otherwise the oldest
+struct ZEntry *_ztier_slot(unsigned long src_id, page_num_t page) {
+    size_t home = (src_id * 31 + page) * 2654435761u;
+    struct ZEntry *oldest = NULL;
+    for (int i = 0; i < ZTIER_PROBE; i++) {
+        struct ZEntry *e = &ztier.index[(home + i) & (ZTIER_ENTRIES - 1)];
+        if (!_ztier_live(e)) { return e; }
+        if (oldest == NULL || e->pos < oldest->pos) { oldest = e; }
+    }
+    return oldest;
+}
+
+// Compress an evicted page into the tier
+void ztier_store(struct CodeSource *src, page_num_t page, frame_t lines) {
+    if (!ztier.enabled || src->data != NULL || _ztier_find(src->id, page) != NULL) { return; }
+
+    uint8_t raw[ZTIER_RAW_MAX];
+    uint8_t packed[ZTIER_RAW_MAX];
+    size_t raw_len = _ztier_serialize(lines, raw);
+    size_t len = ztier_lz_compress(raw, raw_len, packed, raw_len - 1);
+    int compressed = len > 0;
+    if (!compressed) { len = raw_len; }
+    if (len > ZTIER_BYTES) { return; }
+
+    // Entries are contiguous: skip the arena tail if it is too short
+    size_t at = ztier.head % ZTIER_BYTES;
+    if (at + len > ZTIER_BYTES) {
+        ztier.head += ZTIER_BYTES - at;
+        at = 0;
+    }
+    memcpy(ztier.arena + at, compressed ? packed : raw, len);
+
+    *_ztier_slot(src->id, page) = (struct ZEntry) {
+        .src_id = src->id, .page = page, .pos = ztier.head, .len = len, .compressed = compressed,
+    };
+    ztier.head += len;
+
+    ztier.stores++;
+    ztier.bytes_in += raw_len;
+    ztier.bytes_out += len;
+}
+
+// Serve a page from the tier. Return 1 on a hit, 0 on a miss.
+int ztier_load(struct CodeSource *src, page_num_t page, frame_t lines, char (*copy)[CMD_MAX_CHARS]) {
+    if (!ztier.enabled || src->data != NULL) { return 0; }
+    ztier.lookups++;
+
+    struct ZEntry *e = _ztier_find(src->id, page);
+    if (e == NULL) { return 0; }
+
+    uint8_t raw[ZTIER_RAW_MAX];
+    const uint8_t *stored = ztier.arena + e->pos % ZTIER_BYTES;
+    long raw_len = e->len;
+    if (e->compressed) {
+        raw_len = ztier_lz_decompress(stored, e->len, raw, sizeof(raw));
+    } else {
+        memcpy(raw, stored, e->len);
+    }
+    if (raw_len < 0 || _ztier_deserialize(raw, raw_len, lines, copy)) {
+        e->src_id = 0;      // corrupt, forget it and read the file
+        return 0;
+    }
+
+    ztier.hits++;
+    return 1;
+}
+
+void ztier_print_stats() {
+    output_printf(
+        "ztier: %s, %d bytes, %lu pages stored, ratio %.2f, %lu/%lu hits (%.1f%%)\n",
+        ztier.enabled ? "on" : "off", ZTIER_BYTES, ztier.stores,
+        ztier.bytes_out ? (double) ztier.bytes_in / ztier.bytes_out : 0.0,
+        ztier.hits, ztier.lookups,
+        ztier.lookups ? 100.0 * ztier.hits / ztier.lookups : 0.0
+    );
+}
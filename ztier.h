@@ -0,0 +1,28 @@
+/*
+ *  Compressed page tier (zswap-style).
+ *  Pages evicted from the frame store are compressed into a bounded arena, so
+ *  that a later fault on them is served by decompression instead of a file
+ *  read. Only pages of sources read with pread() go through the tier: mapped
+ *  sources refault from the page cache without I/O.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utiltypes.h"
+#include "codesource.h"
+
+#define ZTIER_ENTRIES 1024          // index slots (power of two)
+#define ZTIER_PROBE 8               // slots searched per lookup
+#define ZTIER_LZ_HASH_BITS 10
+#define ZTIER_RAW_MAX (1 + FRAME_SIZE + FRAME_SIZE * CMD_MAX_CHARS)   // serialized page
+
+void ztier_set_enabled(int enabled);
+void ztier_store(struct CodeSource *src, page_num_t page, frame_t lines);
+int ztier_load(struct CodeSource *src, page_num_t page, frame_t lines, char (*copy)[CMD_MAX_CHARS]);
+void ztier_print_stats();
+
+size_t ztier_lz_compress(const uint8_t *in, size_t n, uint8_t *out, size_t cap);
+long ztier_lz_decompress(const uint8_t *in, size_t n, uint8_t *out, size_t cap);